@@ -6,6 +6,9 @@
 #include <cstdio>
 #include <vector>
 #include <map>
+#include <tuple>
+#include <climits>
+#include <cstdlib>
 
 #include "lua.hpp"
 
@@ -13,13 +16,52 @@
 #include "../Modeling/Mesh.hpp"
 #include "../Modeling/GeometryNode.hpp"
 #include "../Modeling/BooleanNode.hpp"
+#include "../Modeling/InstanceNode.hpp"
 #include "../Modeling/Primitive.hpp"
+#include "../Modeling/SphereCloud.hpp"
 #include "../Modeling/Material.hpp"
 #include "../Rendering/Renderer.hpp"
+#include "../Rendering/ThreadPool.hpp"
+#include "../Rendering/Distributed.hpp"
+#include "../Rendering/Texture.hpp"
+#include "../Rendering/TextureCache.hpp"
+#include "../Rendering/AssetLoader.hpp"
 
 typedef std::map<std::string, Mesh *> MeshMap;
 static MeshMap mesh_map;
 
+// Textures by canonical path and how they are decoded and stored, so that nodes using the same file
+// share one copy
+typedef std::map<std::tuple<std::string, Texture::Encoding, Texture::Compression>, Texture *> TextureMap;
+static TextureMap texture_map;
+
+// Load a texture, or find the one already loaded from the same file
+static Texture *loadTexture(const std::string &filename, Texture::Encoding encoding, Texture::Compression compression)
+{
+  // Different spellings of the same path (./a.png, a.png, links) resolve to the same file
+  char resolved[PATH_MAX];
+  std::string path = realpath(filename.c_str(), resolved) != nullptr ? std::string(resolved) : filename;
+
+  auto key = std::make_tuple(path, encoding, compression);
+  auto i = texture_map.find(key);
+  if (i != texture_map.end())
+  {
+    return i->second;
+  }
+
+  Texture *texture = new Texture(filename, encoding, compression);
+  texture_map[key] = texture;
+
+  // Without a budget every level is kept once it is decoded, so decode it while the script runs
+  // instead of in the middle of the render. Under a budget, levels are only decoded if they are used.
+  if (TextureCache::global().budget() == 0)
+  {
+    loadAssetAsync([texture]()
+                   { texture->preload(); });
+  }
+  return texture;
+}
+
 // Uncomment the following line to enable debugging messages
 // #define GRLUA_ENABLE_DEBUG
 
@@ -148,8 +190,54 @@ void get_render_metadata(lua_State *L, int index, RenderMetadata &metadata)
   metadata.enable_supersampling = lua_toboolean(L, -1);
   lua_pop(L, 1);
 
+  lua_getfield(L, index, "enable_sample_grouping");
+  metadata.enable_sample_grouping = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "enable_cost_prediction");
+  metadata.enable_cost_prediction = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "enable_auto_instancing");
+  metadata.enable_auto_instancing = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "enable_progressive");
+  metadata.enable_progressive = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "progressive_samples");
+  metadata.progressive_samples = luaL_optinteger(L, -1, 0);
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "preview_interval");
+  metadata.preview_interval = luaL_optnumber(L, -1, 0.0);
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "enable_denoising");
+  metadata.enable_denoising = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "denoise_iterations");
+  metadata.denoise_iterations = luaL_optinteger(L, -1, 4);
+  lua_pop(L, 1);
+
   lua_getfield(L, index, "thread_count");
-  metadata.thread_count = luaL_checkinteger(L, -1);
+  metadata.thread_count = luaL_optinteger(L, -1, 0);
+  lua_pop(L, 1);
+
+  // Use every core that is available to us if the thread count is not given
+  if (metadata.thread_count == 0)
+  {
+    metadata.thread_count = ThreadPool::global().size();
+  }
+
+  lua_getfield(L, index, "pin_threads");
+  metadata.pin_threads = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "time_budget");
+  metadata.time_budget = luaL_optnumber(L, -1, 0.0);
   lua_pop(L, 1);
 
   lua_getfield(L, index, "background_image");
@@ -208,6 +296,40 @@ extern "C" int gr_cube_cmd(lua_State *L)
   return 1;
 }
 
+// Create a quad node
+extern "C" int gr_quad_cmd(lua_State *L)
+{
+  GRLUA_DEBUG_CALL;
+
+  gr_node_ud *data = (gr_node_ud *)lua_newuserdata(L, sizeof(gr_node_ud));
+  data->node = 0;
+
+  const char *name = luaL_checkstring(L, 1);
+  data->node = new GeometryNode(name, new Quad());
+
+  luaL_getmetatable(L, "gr.node");
+  lua_setmetatable(L, -2);
+
+  return 1;
+}
+
+// Create a disk node
+extern "C" int gr_disk_cmd(lua_State *L)
+{
+  GRLUA_DEBUG_CALL;
+
+  gr_node_ud *data = (gr_node_ud *)lua_newuserdata(L, sizeof(gr_node_ud));
+  data->node = 0;
+
+  const char *name = luaL_checkstring(L, 1);
+  data->node = new GeometryNode(name, new Disk());
+
+  luaL_getmetatable(L, "gr.node");
+  lua_setmetatable(L, -2);
+
+  return 1;
+}
+
 // Create a cylinder node
 extern "C" int gr_cylinder_cmd(lua_State *L)
 {
@@ -265,6 +387,57 @@ extern "C" int gr_nh_sphere_cmd(lua_State *L)
   return 1;
 }
 
+// Create a node with many spheres in one primitive. The positions are a flat array of x, y, z
+// for each sphere, and the radii are an array with one radius for each sphere (or a single number).
+extern "C" int gr_spheres_cmd(lua_State *L)
+{
+  GRLUA_DEBUG_CALL;
+
+  gr_node_ud *data = (gr_node_ud *)lua_newuserdata(L, sizeof(gr_node_ud));
+  data->node = 0;
+
+  const char *name = luaL_checkstring(L, 1);
+
+  luaL_checktype(L, 2, LUA_TTABLE);
+  size_t coordinate_count = lua_rawlen(L, 2);
+  luaL_argcheck(L, coordinate_count % 3 == 0, 2, "x, y, z for each sphere expected");
+
+  std::vector<float> positions(coordinate_count);
+  for (size_t i = 0; i < coordinate_count; ++i)
+  {
+    lua_rawgeti(L, 2, i + 1);
+    positions[i] = luaL_checknumber(L, -1);
+    lua_pop(L, 1);
+  }
+
+  std::vector<float> radii;
+  if (lua_isnumber(L, 3))
+  {
+    radii.push_back(lua_tonumber(L, 3));
+  }
+  else
+  {
+    luaL_checktype(L, 3, LUA_TTABLE);
+    size_t radius_count = lua_rawlen(L, 3);
+    luaL_argcheck(L, radius_count == coordinate_count / 3, 3, "One radius for each sphere expected");
+
+    radii.resize(radius_count);
+    for (size_t i = 0; i < radius_count; ++i)
+    {
+      lua_rawgeti(L, 3, i + 1);
+      radii[i] = luaL_checknumber(L, -1);
+      lua_pop(L, 1);
+    }
+  }
+
+  data->node = new GeometryNode(name, new SphereCloud(positions, radii));
+
+  luaL_getmetatable(L, "gr.node");
+  lua_setmetatable(L, -2);
+
+  return 1;
+}
+
 // Create a non-hierarchical Box node
 extern "C" int gr_nh_box_cmd(lua_State *L)
 {
@@ -308,7 +481,10 @@ extern "C" int gr_mesh_cmd(lua_State *L)
 
   if (i == mesh_map.end())
   {
-    mesh = new Mesh(obj_fname);
+    // Parse the file on the thread pool while the script goes on. Render waits for it.
+    mesh = new Mesh();
+    loadAssetAsync([mesh, sfname]()
+                   { mesh->load(sfname); });
     mesh_map[sfname] = mesh;
   }
   else
@@ -360,10 +536,171 @@ extern "C" int gr_render_cmd(lua_State *L)
   RenderMetadata metadata;
   get_render_metadata(L, 2, metadata);
 
-  Image im(metadata.image_width, metadata.image_height);
+  // With pinned threads, the image is cleared by the render workers instead. This spreads the image over
+  // the memory of their sockets (the first thread to touch a page owns it).
+  Image im(metadata.image_width, metadata.image_height, !metadata.pin_threads);
   Render(root->node, im, metadata);
-  im.savePng(metadata.image_name);
 
+  // Only the coordinator has the whole image
+  if (distributedRole() != DistributedRole::Worker)
+  {
+    im.savePng(metadata.image_name);
+  }
+
+  return 0;
+}
+
+// Call the Lua function on the stack with the given number of arguments. Errors are thrown as exceptions,
+// since the call is made from inside the renderer.
+static void call_lua_function(lua_State *L, int nargs, int nresults, const char *name)
+{
+  if (lua_pcall(L, nargs, nresults, 0) != 0)
+  {
+    std::string message = lua_tostring(L, -1);
+    lua_pop(L, 1);
+    std::cerr << "WARNING: the " << name << " function of the animation failed: " << message << std::endl;
+    throw std::runtime_error("Animation callback failed");
+  }
+}
+
+// Find the frame number placeholder of an image name: a single %d, optionally with a width of
+// at most 2 digits (e.g. %03d), and no other %. Sets [start, end) to the placeholder, and returns false if the
+// name has a % that is not one.
+static bool find_frame_placeholder(const std::string &pattern, size_t &start, size_t &end)
+{
+  start = pattern.find('%');
+  if (start == std::string::npos)
+  {
+    end = start;
+    return true;
+  }
+
+  end = start + 1;
+  while (end < pattern.size() && std::isdigit((unsigned char)pattern[end]))
+  {
+    end++;
+  }
+  if (end >= pattern.size() || pattern[end] != 'd' || end - start > 3)
+  {
+    return false;
+  }
+
+  end++;
+  return pattern.find('%', end) == std::string::npos;
+}
+
+// The image name of a frame. The name may contain a placeholder for the frame number (e.g.
+// "turntable_%03d.png"), otherwise the frame number is added before the extension.
+static std::string frame_image_name(const std::string &pattern, int frame)
+{
+  size_t start, end;
+  if (find_frame_placeholder(pattern, start, end) && start != std::string::npos)
+  {
+    // The width is at most 2 digits, and the format is built here rather than taken from the name
+    int width = end - start > 2 ? std::atoi(pattern.substr(start + 1, end - start - 2).c_str()) : 0;
+    char number[128];
+    snprintf(number, sizeof(number), pattern[start + 1] == '0' ? "%0*d" : "%*d", width, frame);
+    return pattern.substr(0, start) + number + pattern.substr(end);
+  }
+
+  char number[16];
+  snprintf(number, sizeof(number), "_%04d", frame);
+  size_t extension = pattern.rfind('.');
+  if (extension == std::string::npos || pattern.find('/', extension) != std::string::npos)
+  {
+    return pattern + number;
+  }
+  return pattern.substr(0, extension) + number + pattern.substr(extension);
+}
+
+// Render an animation
+extern "C" int gr_animate_cmd(lua_State *L)
+{
+  GRLUA_DEBUG_CALL;
+
+  gr_node_ud *root = (gr_node_ud *)luaL_checkudata(L, 1, "gr.node");
+  luaL_argcheck(L, root != 0, 1, "Root node expected");
+
+  RenderMetadata base_metadata;
+  get_render_metadata(L, 2, base_metadata);
+
+  size_t placeholder_start, placeholder_end;
+  if (!find_frame_placeholder(base_metadata.image_name, placeholder_start, placeholder_end))
+  {
+    return luaL_error(L, "image_name may only contain a single %%d, with a width of at most 2 digits (e.g. %%03d), for the frame number: %s",
+                      base_metadata.image_name.c_str());
+  }
+
+  // The animation: frame_start (default 1), frame_end, and the optional camera and update functions
+  luaL_checktype(L, 3, LUA_TTABLE);
+
+  lua_getfield(L, 3, "frame_start");
+  int frame_start = luaL_optinteger(L, -1, 1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, 3, "frame_end");
+  int frame_end = luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+
+  // camera(frame) returns a table with any of camera_eye, camera_view, camera_up and camera_fovy
+  lua_getfield(L, 3, "camera");
+  int camera_index = lua_gettop(L);
+  bool has_camera = lua_isfunction(L, camera_index);
+
+  // update(frame) changes the scene (e.g. the transforms of nodes) before the frame is rendered
+  lua_getfield(L, 3, "update");
+  int update_index = lua_gettop(L);
+  bool has_update = lua_isfunction(L, update_index);
+
+  auto frame_metadata = [&](int frame)
+  {
+    RenderMetadata metadata = base_metadata;
+    metadata.image_name = frame_image_name(base_metadata.image_name, frame);
+    if (!has_camera)
+    {
+      return metadata;
+    }
+
+    lua_pushvalue(L, camera_index);
+    lua_pushinteger(L, frame);
+    call_lua_function(L, 1, 1, "camera");
+    if (lua_istable(L, -1))
+    {
+      const char *vectors[] = {"camera_eye", "camera_view", "camera_up"};
+      glm::vec3 *values[] = {&metadata.camera_eye, &metadata.camera_view, &metadata.camera_up};
+      for (int i = 0; i < 3; i++)
+      {
+        lua_getfield(L, -1, vectors[i]);
+        if (!lua_isnil(L, -1))
+        {
+          get_tuple(L, -1, &(*values[i])[0], 3);
+        }
+        lua_pop(L, 1);
+      }
+
+      lua_getfield(L, -1, "camera_fovy");
+      metadata.camera_fovy = luaL_optnumber(L, -1, metadata.camera_fovy);
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+
+    return metadata;
+  };
+
+  std::function<void(int)> update = nullptr;
+  if (has_update)
+  {
+    update = [&](int frame)
+    {
+      lua_pushvalue(L, update_index);
+      lua_pushinteger(L, frame);
+      call_lua_function(L, 1, 0, "update");
+    };
+  }
+
+  Animate(root->node, frame_start, frame_end, frame_metadata, update);
+
+  lua_pop(L, 2);
   return 0;
 }
 
@@ -395,6 +732,36 @@ extern "C" int gr_material_cmd(lua_State *L)
   return 1;
 }
 
+// Configure the texture cache with any of:
+//   budget_mb: the most memory that decoded textures may use before the least recently used levels
+//              are evicted (0, the default, for no limit)
+//   directory: where to keep decoded copies of the textures, which later runs map instead of decoding
+//              the PNG files again. Only applies to textures loaded after this call.
+extern "C" int gr_texture_cache_cmd(lua_State *L)
+{
+  GRLUA_DEBUG_CALL;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+
+  lua_getfield(L, 1, "budget_mb");
+  if (!lua_isnil(L, -1))
+  {
+    double budget_mb = luaL_checknumber(L, -1);
+    luaL_argcheck(L, budget_mb >= 0.0, 1, "budget_mb must not be negative");
+    TextureCache::global().setBudget((size_t)(budget_mb * 1024 * 1024));
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, 1, "directory");
+  if (!lua_isnil(L, -1))
+  {
+    TextureCache::global().setDirectory(luaL_checkstring(L, -1));
+  }
+  lua_pop(L, 1);
+
+  return 0;
+}
+
 // Create an intersection node
 extern "C" int gr_intersection_cmd(lua_State *L)
 {
@@ -446,6 +813,27 @@ extern "C" int gr_difference_cmd(lua_State *L)
   return 1;
 }
 
+// Create an instance of another node (the prototype), which shares its geometry
+extern "C" int gr_instance_cmd(lua_State *L)
+{
+  GRLUA_DEBUG_CALL;
+
+  gr_node_ud *data = (gr_node_ud *)lua_newuserdata(L, sizeof(gr_node_ud));
+  data->node = 0;
+
+  const char *name = luaL_checkstring(L, 1);
+
+  gr_node_ud *prototypedata = (gr_node_ud *)luaL_checkudata(L, 2, "gr.node");
+  luaL_argcheck(L, prototypedata != 0, 2, "Node expected");
+
+  data->node = new InstanceNode(name, prototypedata->node);
+
+  luaL_getmetatable(L, "gr.node");
+  lua_setmetatable(L, -2);
+
+  return 1;
+}
+
 // Add a Child to a node
 extern "C" int gr_node_add_child_cmd(lua_State *L)
 {
@@ -474,20 +862,45 @@ extern "C" int gr_node_set_material_cmd(lua_State *L)
   gr_node_ud *selfdata = (gr_node_ud *)luaL_checkudata(L, 1, "gr.node");
   luaL_argcheck(L, selfdata != 0, 1, "Node expected");
 
-  GeometryNode *self = dynamic_cast<GeometryNode *>(selfdata->node);
-
-  luaL_argcheck(L, self != 0, 1, "Geometry node expected");
-
   gr_material_ud *matdata = (gr_material_ud *)luaL_checkudata(L, 2, "gr.material");
   luaL_argcheck(L, matdata != 0, 2, "Material expected");
 
   Material *material = matdata->material;
 
+  // The material of an instance replaces the materials of its prototype
+  InstanceNode *instance = dynamic_cast<InstanceNode *>(selfdata->node);
+  if (instance)
+  {
+    instance->setMaterial(material);
+    return 0;
+  }
+
+  GeometryNode *self = dynamic_cast<GeometryNode *>(selfdata->node);
+
+  luaL_argcheck(L, self != 0, 1, "Geometry node expected");
+
   self->setMaterial(material);
 
   return 0;
 }
 
+// The options of set_texture and set_normal, in an optional table after the file name:
+//   compressed: store the texture in compressed 4x4 blocks, for a fraction of the memory
+static Texture::Compression get_texture_compression(lua_State *L, int index)
+{
+  if (lua_isnoneornil(L, index))
+  {
+    return Texture::Compression::None;
+  }
+
+  luaL_checktype(L, index, LUA_TTABLE);
+  lua_getfield(L, index, "compressed");
+  bool compressed = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
+  return compressed ? Texture::Compression::Block : Texture::Compression::None;
+}
+
 // Set a node's Texture
 extern "C" int gr_node_set_texture_cmd(lua_State *L)
 {
@@ -502,7 +915,7 @@ extern "C" int gr_node_set_texture_cmd(lua_State *L)
 
   const char *fname = luaL_checkstring(L, 2);
 
-  self->setTexture(fname);
+  self->setTexture(loadTexture(fname, Texture::Encoding::Color, get_texture_compression(L, 3)));
 
   return 0;
 }
@@ -521,7 +934,7 @@ extern "C" int gr_node_set_normal_cmd(lua_State *L)
 
   const char *fname = luaL_checkstring(L, 2);
 
-  self->setNormal(fname);
+  self->setNormal(loadTexture(fname, Texture::Encoding::Normal, get_texture_compression(L, 3)));
 
   return 0;
 }
@@ -548,8 +961,7 @@ extern "C" int gr_node_set_emission_cmd(lua_State *L)
 
   l.colour = glm::vec3(col[0], col[1], col[2]);
 
-  self->m_emission = new Light(l);
-  self->m_emission_samples = samples;
+  self->setEmission(new Light(l), samples);
 
   return 0;
 }
@@ -651,16 +1063,22 @@ static const luaL_Reg grlib_functions[] = {
     {"material", gr_material_cmd},
     // New for assignment 4
     {"cube", gr_cube_cmd},
+    {"quad", gr_quad_cmd},
+    {"disk", gr_disk_cmd},
     {"nh_sphere", gr_nh_sphere_cmd},
     {"nh_box", gr_nh_box_cmd},
+    {"spheres", gr_spheres_cmd},
     {"mesh", gr_mesh_cmd},
     {"light", gr_light_cmd},
     {"render", gr_render_cmd},
+    {"animate", gr_animate_cmd},
     {"cylinder", gr_cylinder_cmd},
     {"cone", gr_cone_cmd},
     {"intersection", gr_intersection_cmd},
     {"union", gr_union_cmd},
     {"difference", gr_difference_cmd},
+    {"instance", gr_instance_cmd},
+    {"texture_cache", gr_texture_cache_cmd},
     {0, 0}};
 
 // This is where all the member functions for "gr.node" objects are
@@ -686,6 +1104,7 @@ static const luaL_Reg grlib_node_methods[] = {
     {"rotate", gr_node_rotate_cmd},
     {"translate", gr_node_translate_cmd},
     {"render", gr_render_cmd},
+    {"animate", gr_animate_cmd},
     {0, 0}};
 
 // This function calls the lua interpreter to define the scene and
@@ -20,6 +20,18 @@ struct RenderMetadata
   glm::vec3 scene_ambient;
   std::list<Light *> scene_lights;
   bool enable_supersampling;
+  bool enable_sample_grouping;
+  bool enable_cost_prediction;
+  bool enable_auto_instancing;
+  bool enable_progressive;
+  int progressive_samples;
+  double preview_interval;
+  bool enable_denoising;
+  int denoise_iterations;
   uint thread_count;
+  bool pin_threads;
+  double time_budget;
   std::string background_image;
+  // Not set from the script. Frames that are rendered at the same time share one progress report instead.
+  bool report_progress = true;
 };
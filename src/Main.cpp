@@ -1,22 +1,82 @@
 #include <iostream>
+#include <string>
 #include "./Lua/scene_lua.hpp"
+#include "./Rendering/Telemetry.hpp"
+#include "./Rendering/Distributed.hpp"
 
+// Usage: Raytracer [scene.lua] [options]
+//   --listen <address>        Coordinate a distributed render, and wait for workers on the address
+//   --spawn-workers <n>       Coordinate a distributed render, and start n local worker processes
+//   --connect <address>       Be a worker for the coordinator at the address
+//   --tile-timeout <seconds>  Hand out tiles again if a worker has not returned them in this time
+// Addresses are "unix:<path>" for a Unix socket, or "[host:]port" for TCP.
 int main(int argc, char **argv)
 {
   std::string filename = "simple.lua";
-  if (argc >= 2)
+  DistributedOptions distributed;
+  distributed.executable = argv[0];
+
+  for (int i = 1; i < argc; ++i)
   {
-    filename = argv[1];
+    std::string arg = argv[i];
+    if ((arg == "--listen" || arg == "--spawn-workers" || arg == "--connect" || arg == "--tile-timeout") && i + 1 >= argc)
+    {
+      std::cerr << arg << " needs a value" << std::endl;
+      return 1;
+    }
+
+    if (arg == "--listen")
+    {
+      distributed.role = DistributedRole::Coordinator;
+      distributed.address = argv[++i];
+    }
+    else if (arg == "--spawn-workers")
+    {
+      distributed.role = DistributedRole::Coordinator;
+      distributed.spawn_workers = std::stoi(argv[++i]);
+    }
+    else if (arg == "--connect")
+    {
+      distributed.role = DistributedRole::Worker;
+      distributed.address = argv[++i];
+    }
+    else if (arg == "--tile-timeout")
+    {
+      distributed.tile_timeout = std::stod(argv[++i]);
+    }
+    else
+    {
+      filename = arg;
+    }
+  }
+  distributed.scene_file = filename;
+
+  // Local workers are reached over any free port, unless an address is given
+  if (distributed.role == DistributedRole::Coordinator && distributed.address.empty())
+  {
+    distributed.address = "127.0.0.1:0";
   }
 
+  // Print the render counters when the process receives SIGUSR1
+  installTelemetrySignalHandler();
+
   try
   {
-    if (!run_lua(filename))
+    startDistributed(distributed);
+    bool success = run_lua(filename);
+    stopDistributed();
+
+    if (!success)
     {
       std::cerr << "Could not open " << filename << ". Try running the executable from inside of" << " the Assets/ directory" << std::endl;
       return 1;
     }
   }
+  catch (const std::exception &e)
+  {
+    std::cerr << "An exception occurred: " << e.what() << std::endl;
+    return 1;
+  }
   catch (...) // catch all exceptions
   {
     std::cerr << "An exception occurred" << std::endl;
@@ -10,15 +10,6 @@ GeometryNode::GeometryNode(
 
 GeometryNode::~GeometryNode()
 {
-	if (m_texture != nullptr)
-	{
-		delete m_texture;
-	}
-
-	if (m_normal != nullptr)
-	{
-		delete m_normal;
-	}
 }
 
 void GeometryNode::setMaterial(Material *mat)
@@ -35,24 +26,25 @@ void GeometryNode::setMaterial(Material *mat)
 	//     crash the program.
 
 	m_material = mat;
+	// Nodes with different materials can no longer share an automatic instance
+	markChanged();
 }
 
-void GeometryNode::setTexture(const std::string &texture)
+void GeometryNode::setTexture(Texture *texture)
 {
-	if (m_texture != nullptr)
-	{
-		delete m_texture;
-	}
-
-	m_texture = new Image(texture);
+	m_texture = texture;
+	markChanged();
 }
 
-void GeometryNode::setNormal(const std::string &normal)
+void GeometryNode::setNormal(Texture *normal)
 {
-	if (m_normal != nullptr)
-	{
-		delete m_normal;
-	}
+	m_normal = normal;
+	markChanged();
+}
 
-	m_normal = new Image(normal);
+void GeometryNode::setEmission(Light *emission, int samples)
+{
+	m_emission = emission;
+	m_emission_samples = samples;
+	markChanged();
 }
\ No newline at end of file
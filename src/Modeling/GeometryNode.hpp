@@ -3,7 +3,7 @@
 #include "SceneNode.hpp"
 #include "Primitive.hpp"
 #include "Material.hpp"
-#include "../Rendering/Image.hpp"
+#include "../Rendering/Texture.hpp"
 
 class GeometryNode : public SceneNode
 {
@@ -13,13 +13,16 @@ public:
 	~GeometryNode();
 
 	void setMaterial(Material *material);
-	void setTexture(const std::string &texture);
-	void setNormal(const std::string &normal);
+	// Textures are shared between nodes, and are not deleted with them
+	void setTexture(Texture *texture);
+	void setNormal(Texture *normal);
+	// Make the node an area light. The light is owned by the node.
+	void setEmission(Light *emission, int samples);
 
 	Material *m_material;
 	Primitive *m_primitive;
-	Image *m_texture;
-	Image *m_normal;
+	Texture *m_texture;
+	Texture *m_normal;
 	Light *m_emission;
 	int m_emission_samples;
 };
@@ -0,0 +1,17 @@
+#include "InstanceNode.hpp"
+
+//---------------------------------------------------------------------------------------
+InstanceNode::InstanceNode(
+    const std::string &name, SceneNode *prototype)
+    : SceneNode(name), m_prototype(prototype), m_material(nullptr)
+{
+    m_nodeType = NodeType::InstanceNode;
+}
+
+InstanceNode::~InstanceNode() {}
+
+void InstanceNode::setMaterial(Material *material)
+{
+    m_material = material;
+    markChanged();
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "SceneNode.hpp"
+#include "Material.hpp"
+
+// A copy of another subtree (the prototype), placed with its own transform. Every instance of a
+// prototype shares one acceleration structure, so each instance only costs its node.
+// The prototype is not part of the scene itself, and its area lights are not sampled as lights.
+class InstanceNode : public SceneNode
+{
+public:
+    InstanceNode(const std::string &name, SceneNode *prototype);
+    ~InstanceNode();
+
+    void setMaterial(Material *material);
+
+    SceneNode *m_prototype;
+    // Replaces the material of everything in the prototype, if set
+    Material *m_material;
+};
@@ -7,8 +7,19 @@
 #include "Mesh.hpp"
 #include "../Rendering/intersection.hpp"
 
-Mesh::Mesh(const std::string &fname)
+Mesh::Mesh()
 	: m_vertices(), m_faces(), m_normals(), m_uvs()
+{
+}
+
+Mesh::Mesh(const std::string &fname)
+	: Mesh()
+{
+	load(fname);
+}
+
+// Parse an OBJ file into the (empty) mesh
+void Mesh::load(const std::string &fname)
 {
 	std::ifstream ifs(fname.c_str());
 	std::string line;
@@ -151,6 +162,11 @@ Mesh::Mesh(const std::string &fname)
 			std::cerr << "Unknown or malformed line: " << line << std::endl;
 		}
 	}
+
+	for (const auto &vertex : m_vertices)
+	{
+		m_bounds.extend(vertex);
+	}
 }
 
 std::ostream &operator<<(std::ostream &out, const Mesh &mesh)
@@ -161,16 +177,7 @@ std::ostream &operator<<(std::ostream &out, const Mesh &mesh)
 
 Intersection Mesh::intersect(const Ray &ray)
 {
-	// Get a bounding box for the mesh
-	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
-	glm::vec3 max = glm::vec3(std::numeric_limits<float>::min());
-	for (const auto &vertex : m_vertices)
-	{
-		min = glm::min(min, vertex);
-		max = glm::max(max, vertex);
-	}
-
-	Intersection boxIntersection = intersectWithBox(ray, min, max);
+	Intersection boxIntersection = intersectWithBox(ray, m_bounds.min, m_bounds.max);
 #ifdef RENDER_BOUNDING_VOLUMES
 	return boxIntersection;
 #endif
@@ -245,6 +252,11 @@ glm::vec3 Mesh::getCenter()
 	return (min + max) / 2.0f;
 }
 
+AABB Mesh::getBounds()
+{
+	return m_bounds;
+}
+
 glm::vec3 Mesh::samplePoint()
 {
 	return getCenter();
@@ -37,10 +37,15 @@ struct Triangle
 class Mesh : public Primitive
 {
 public:
+	// An empty mesh, to be filled in with load()
+	Mesh();
 	Mesh(const std::string &fname);
+	void load(const std::string &fname);
+
 	virtual Intersection intersect(const Ray &ray) override;
 	virtual glm::vec3 samplePoint() override;
 	virtual glm::vec3 getCenter() override;
+	virtual AABB getBounds() override;
 
 private:
 	std::vector<glm::vec3> m_vertices;
@@ -48,5 +53,8 @@ private:
 	std::vector<glm::vec2> m_uvs;
 	std::vector<Triangle> m_faces;
 
+	// The bounding box of the vertices, computed once when the mesh is loaded
+	AABB m_bounds;
+
 	friend std::ostream &operator<<(std::ostream &out, const Mesh &mesh);
 };
@@ -10,6 +10,11 @@ Primitive::~Primitive()
 {
 }
 
+bool Primitive::sameShape(const Primitive *other) const
+{
+    return this == other;
+}
+
 Sphere::~Sphere()
 {
 }
@@ -36,6 +41,16 @@ glm::vec3 Sphere::getCenter()
     return glm::vec3(0);
 }
 
+AABB Sphere::getBounds()
+{
+    return AABB(glm::vec3(-1.0f), glm::vec3(1.0f));
+}
+
+bool Sphere::sameShape(const Primitive *other) const
+{
+    return dynamic_cast<const Sphere *>(other) != nullptr;
+}
+
 Cube::~Cube()
 {
 }
@@ -82,6 +97,16 @@ glm::vec3 Cube::getCenter()
     return glm::vec3(0.5);
 }
 
+AABB Cube::getBounds()
+{
+    return AABB(glm::vec3(0.0f), glm::vec3(1.0f));
+}
+
+bool Cube::sameShape(const Primitive *other) const
+{
+    return dynamic_cast<const Cube *>(other) != nullptr;
+}
+
 Cylinder::~Cylinder()
 {
 }
@@ -121,6 +146,16 @@ glm::vec3 Cylinder::getCenter()
     return glm::vec3(0, 0.5, 0);
 }
 
+AABB Cylinder::getBounds()
+{
+    return AABB(glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f));
+}
+
+bool Cylinder::sameShape(const Primitive *other) const
+{
+    return dynamic_cast<const Cylinder *>(other) != nullptr;
+}
+
 Cone::~Cone()
 {
 }
@@ -140,6 +175,77 @@ glm::vec3 Cone::getCenter()
     throw std::runtime_error("Not implemented");
 }
 
+AABB Cone::getBounds()
+{
+    // The apex is at the origin, and the base (of radius 1) at y = -1
+    return AABB(glm::vec3(-1.0f), glm::vec3(1.0f, 0.0f, 1.0f));
+}
+
+bool Cone::sameShape(const Primitive *other) const
+{
+    return dynamic_cast<const Cone *>(other) != nullptr;
+}
+
+Quad::~Quad()
+{
+}
+
+Intersection Quad::intersect(const Ray &ray)
+{
+    return intersectWithQuad(ray, glm::vec3(0), glm::vec2(1));
+}
+
+glm::vec3 Quad::samplePoint()
+{
+    return glm::vec3(uniform01(gen), 0, uniform01(gen));
+}
+
+glm::vec3 Quad::getCenter()
+{
+    return glm::vec3(0.5, 0, 0.5);
+}
+
+AABB Quad::getBounds()
+{
+    return AABB(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 1.0f));
+}
+
+bool Quad::sameShape(const Primitive *other) const
+{
+    return dynamic_cast<const Quad *>(other) != nullptr;
+}
+
+Disk::~Disk()
+{
+}
+
+Intersection Disk::intersect(const Ray &ray)
+{
+    return intersectWithDisk(ray, glm::vec3(0), 1.0);
+}
+
+glm::vec3 Disk::samplePoint()
+{
+    float theta = uniform01(gen) * 2.0f * M_PI;
+    float radius = glm::sqrt(uniform01(gen)); // sqrt for uniform distribution
+    return glm::vec3(radius * glm::cos(theta), 0, radius * glm::sin(theta));
+}
+
+glm::vec3 Disk::getCenter()
+{
+    return glm::vec3(0);
+}
+
+AABB Disk::getBounds()
+{
+    return AABB(glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f, 0.0f, 1.0f));
+}
+
+bool Disk::sameShape(const Primitive *other) const
+{
+    return dynamic_cast<const Disk *>(other) != nullptr;
+}
+
 NonhierSphere::~NonhierSphere()
 {
 }
@@ -159,6 +265,17 @@ glm::vec3 NonhierSphere::getCenter()
     throw std::runtime_error("Not implemented");
 }
 
+AABB NonhierSphere::getBounds()
+{
+    return AABB(m_pos - glm::vec3(m_radius), m_pos + glm::vec3(m_radius));
+}
+
+bool NonhierSphere::sameShape(const Primitive *other) const
+{
+    const NonhierSphere *sphere = dynamic_cast<const NonhierSphere *>(other);
+    return sphere != nullptr && sphere->m_pos == m_pos && sphere->m_radius == m_radius;
+}
+
 NonhierBox::~NonhierBox()
 {
 }
@@ -176,4 +293,15 @@ glm::vec3 NonhierBox::samplePoint()
 glm::vec3 NonhierBox::getCenter()
 {
     throw std::runtime_error("Not implemented");
+}
+
+AABB NonhierBox::getBounds()
+{
+    return AABB(m_pos, m_pos + glm::vec3(m_size));
+}
+
+bool NonhierBox::sameShape(const Primitive *other) const
+{
+    const NonhierBox *box = dynamic_cast<const NonhierBox *>(other);
+    return box != nullptr && box->m_pos == m_pos && box->m_size == m_size;
 }
\ No newline at end of file
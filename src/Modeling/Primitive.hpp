@@ -12,6 +12,10 @@ public:
   virtual Intersection intersect(const Ray &ray) = 0;
   virtual glm::vec3 samplePoint() = 0;
   virtual glm::vec3 getCenter() = 0;
+  // The bounds of the primitive in its local space
+  virtual AABB getBounds() = 0;
+  // Whether the other primitive has the same shape, so that nodes with either can be instances of one prototype
+  virtual bool sameShape(const Primitive *other) const;
 };
 
 class Sphere : public Primitive
@@ -21,6 +25,8 @@ public:
   virtual Intersection intersect(const Ray &ray) override;
   virtual glm::vec3 samplePoint() override;
   virtual glm::vec3 getCenter() override;
+  virtual AABB getBounds() override;
+  virtual bool sameShape(const Primitive *other) const override;
 };
 
 class Cube : public Primitive
@@ -30,6 +36,8 @@ public:
   virtual Intersection intersect(const Ray &ray) override;
   virtual glm::vec3 samplePoint() override;
   virtual glm::vec3 getCenter() override;
+  virtual AABB getBounds() override;
+  virtual bool sameShape(const Primitive *other) const override;
 };
 
 class Cylinder : public Primitive
@@ -39,6 +47,8 @@ public:
   virtual Intersection intersect(const Ray &ray) override;
   virtual glm::vec3 samplePoint() override;
   virtual glm::vec3 getCenter() override;
+  virtual AABB getBounds() override;
+  virtual bool sameShape(const Primitive *other) const override;
 };
 
 class Cone : public Primitive
@@ -48,6 +58,32 @@ public:
   virtual Intersection intersect(const Ray &ray) override;
   virtual glm::vec3 samplePoint() override;
   virtual glm::vec3 getCenter() override;
+  virtual AABB getBounds() override;
+  virtual bool sameShape(const Primitive *other) const override;
+};
+
+// The unit square [0, 1] x [0, 1] in the XZ plane, facing up. A flat alternative to a thin cube.
+class Quad : public Primitive
+{
+public:
+  virtual ~Quad();
+  virtual Intersection intersect(const Ray &ray) override;
+  virtual glm::vec3 samplePoint() override;
+  virtual glm::vec3 getCenter() override;
+  virtual AABB getBounds() override;
+  virtual bool sameShape(const Primitive *other) const override;
+};
+
+// The unit disk around the origin in the XZ plane, facing up. A flat alternative to a thin cylinder.
+class Disk : public Primitive
+{
+public:
+  virtual ~Disk();
+  virtual Intersection intersect(const Ray &ray) override;
+  virtual glm::vec3 samplePoint() override;
+  virtual glm::vec3 getCenter() override;
+  virtual AABB getBounds() override;
+  virtual bool sameShape(const Primitive *other) const override;
 };
 
 class NonhierSphere : public Primitive
@@ -61,6 +97,8 @@ public:
   virtual Intersection intersect(const Ray &ray) override;
   virtual glm::vec3 samplePoint() override;
   virtual glm::vec3 getCenter() override;
+  virtual AABB getBounds() override;
+  virtual bool sameShape(const Primitive *other) const override;
 
 private:
   glm::vec3 m_pos;
@@ -79,6 +117,8 @@ public:
   virtual Intersection intersect(const Ray &ray) override;
   virtual glm::vec3 samplePoint() override;
   virtual glm::vec3 getCenter() override;
+  virtual AABB getBounds() override;
+  virtual bool sameShape(const Primitive *other) const override;
 
 private:
   glm::vec3 m_pos;
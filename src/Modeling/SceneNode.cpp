@@ -12,6 +12,7 @@ using namespace glm;
 
 // Static class variable
 unsigned int SceneNode::nodeInstanceCount = 0;
+unsigned long long SceneNode::nodeTransformGeneration = 0;
 
 //---------------------------------------------------------------------------------------
 SceneNode::SceneNode(const std::string &name)
@@ -52,6 +53,7 @@ void SceneNode::set_transform(const glm::mat4 &m)
 	trans = m;
 	invtrans = glm::inverse(m);
 	transpose_inv_trans = glm::transpose(glm::inverse(glm::mat3(trans)));
+	nodeTransformGeneration++;
 }
 
 //---------------------------------------------------------------------------------------
@@ -70,12 +72,14 @@ const glm::mat4 &SceneNode::get_inverse() const
 void SceneNode::add_child(SceneNode *child)
 {
 	children.push_back(child);
+	nodeTransformGeneration++;
 }
 
 //---------------------------------------------------------------------------------------
 void SceneNode::remove_child(SceneNode *child)
 {
 	children.remove(child);
+	nodeTransformGeneration++;
 }
 
 //---------------------------------------------------------------------------------------
@@ -119,6 +123,18 @@ int SceneNode::totalSceneNodes() const
 	return nodeInstanceCount;
 }
 
+//---------------------------------------------------------------------------------------
+unsigned long long SceneNode::transformGeneration()
+{
+	return nodeTransformGeneration;
+}
+
+//---------------------------------------------------------------------------------------
+void SceneNode::markChanged()
+{
+	nodeTransformGeneration++;
+}
+
 //---------------------------------------------------------------------------------------
 std::ostream &operator<<(std::ostream &os, const SceneNode &node)
 {
@@ -135,6 +151,9 @@ std::ostream &operator<<(std::ostream &os, const SceneNode &node)
 	case NodeType::BooleanNode:
 		os << "BooleanNode";
 		break;
+	case NodeType::InstanceNode:
+		os << "InstanceNode";
+		break;
 	}
 	os << ":[";
 
@@ -13,6 +13,7 @@ enum class NodeType
     SceneNode,
     GeometryNode,
     BooleanNode,
+    InstanceNode,
 };
 
 class SceneNode
@@ -26,6 +27,11 @@ public:
 
     int totalSceneNodes() const;
 
+    // Changes every time the transform, the children or the appearance (material, textures or emission)
+    // of any node change. This lets the renderer skip updating its acceleration structure when nothing
+    // has changed since the last render.
+    static unsigned long long transformGeneration();
+
     const glm::mat4 &get_transform() const;
     const glm::mat4 &get_inverse() const;
 
@@ -55,7 +61,13 @@ public:
 
     glm::mat4 totalHierarchyTransform;
 
+protected:
+    // Record a change that the acceleration structure depends on
+    static void markChanged();
+
 private:
     // The number of SceneNode instances.
     static unsigned int nodeInstanceCount;
+
+    static unsigned long long nodeTransformGeneration;
 };
@@ -0,0 +1,234 @@
+#include "SphereCloud.hpp"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+// The most spheres in a leaf of the BVH. They are all tested together.
+const uint32_t SPHERE_LEAF_SIZE = 8;
+
+// The BVH splits on one bit of the 30 bit Morton codes at every level, and then in half, so this is always deep enough
+const int SPHERE_STACK_SIZE = 64;
+
+// Hits closer than this are ignored, like the hits of other primitives (see computeLeafIntersection)
+const float MIN_SPHERE_HIT_T = 0.001f;
+
+// Spread the lowest 10 bits of v out to every third bit
+static uint32_t spreadBits(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Interleave the bits of x, y and z, so that sorting by the result gives a Z-order (Morton) curve
+static uint32_t mortonCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+static std::random_device rd;
+static std::mt19937 gen(rd());
+static std::uniform_real_distribution<float> uniform01(0.0f, 1.0f);
+
+SphereCloud::SphereCloud(const std::vector<float> &positions, const std::vector<float> &radii)
+{
+    if (positions.size() % 3 != 0)
+    {
+        throw std::runtime_error("Sphere positions must have 3 coordinates each");
+    }
+
+    size_t count = positions.size() / 3;
+    if (radii.size() != 1 && radii.size() != count)
+    {
+        throw std::runtime_error("There must be one radius, or one radius for each sphere");
+    }
+
+    AABB centerBounds;
+    for (size_t i = 0; i < count; ++i)
+    {
+        centerBounds.extend(glm::vec3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]));
+    }
+
+    // Sort the spheres along a Morton curve, so that spheres that are close together end up next to each
+    // other. The BVH is then built by splitting the sorted spheres in half, which is much faster than
+    // partitioning them at every level.
+    glm::vec3 scale = 1023.0f / glm::max(centerBounds.max - centerBounds.min, glm::vec3(1e-20f));
+    std::vector<uint64_t> keys(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        glm::vec3 cell = (glm::vec3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]) - centerBounds.min) * scale;
+        keys[i] = (uint64_t)mortonCode((uint32_t)cell.x, (uint32_t)cell.y, (uint32_t)cell.z) << 32 | i;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    m_x.resize(count);
+    m_y.resize(count);
+    m_z.resize(count);
+    m_radius.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t sphere = (uint32_t)keys[i];
+        m_x[i] = positions[3 * sphere];
+        m_y[i] = positions[3 * sphere + 1];
+        m_z[i] = positions[3 * sphere + 2];
+        m_radius[i] = radii.size() == 1 ? radii[0] : radii[sphere];
+    }
+
+    if (count > 0)
+    {
+        m_nodes.reserve(4 * (count / SPHERE_LEAF_SIZE + 1));
+        build(keys, 0, count);
+    }
+}
+
+SphereCloud::~SphereCloud()
+{
+}
+
+// Build the subtree over the spheres [begin, end), which are sorted by their Morton keys, and return the index of its root
+uint32_t SphereCloud::build(const std::vector<uint64_t> &keys, uint32_t begin, uint32_t end)
+{
+    uint32_t index = m_nodes.size();
+    m_nodes.push_back(Node());
+
+    if (end - begin <= SPHERE_LEAF_SIZE)
+    {
+        AABB bounds;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            glm::vec3 center(m_x[i], m_y[i], m_z[i]);
+            bounds.extend(center - glm::vec3(m_radius[i]));
+            bounds.extend(center + glm::vec3(m_radius[i]));
+        }
+        m_nodes[index].bounds = bounds;
+        m_nodes[index].index = begin;
+        m_nodes[index].count = end - begin;
+        return index;
+    }
+
+    // Split where the highest bit that differs between the Morton codes changes, which splits the cell
+    // of the node in half along one axis. If all the codes are the same, split the spheres in half.
+    uint32_t firstCode = keys[begin] >> 32;
+    uint32_t lastCode = keys[end - 1] >> 32;
+    uint32_t middle = begin + (end - begin) / 2;
+    if (firstCode != lastCode)
+    {
+        uint32_t splitBit = 1u << (31 - __builtin_clz(firstCode ^ lastCode));
+        middle = std::partition_point(keys.begin() + begin, keys.begin() + end, [splitBit](uint64_t key)
+                                      { return ((key >> 32) & splitBit) == 0; }) -
+                 keys.begin();
+    }
+    build(keys, begin, middle);
+    uint32_t right = build(keys, middle, end);
+
+    AABB bounds = m_nodes[index + 1].bounds;
+    bounds.extend(m_nodes[right].bounds);
+    m_nodes[index].bounds = bounds;
+    m_nodes[index].index = right;
+    m_nodes[index].count = 0;
+    return index;
+}
+
+Intersection SphereCloud::intersect(const Ray &ray)
+{
+    if (m_nodes.empty())
+    {
+        return Intersection();
+    }
+
+    glm::vec3 inverseDirection = 1.0f / ray.direction;
+    float closestT = std::numeric_limits<float>::infinity();
+    uint32_t closest = 0;
+    bool hit = false;
+
+    uint32_t stack[SPHERE_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        uint32_t index = stack[--stackSize];
+        const Node &node = m_nodes[index];
+        float tEntry;
+        if (!node.bounds.intersect(ray.start, inverseDirection, closestT, tEntry))
+        {
+            continue;
+        }
+
+        if (node.count == 0)
+        {
+            stack[stackSize++] = node.index;
+            stack[stackSize++] = index + 1;
+            continue;
+        }
+
+        // Test every sphere of the leaf with the math of intersectWithSphere (the ray direction has unit length).
+        // The loop has no branches, so that the compiler can vectorize it.
+        float t[SPHERE_LEAF_SIZE];
+        const float *x = &m_x[node.index];
+        const float *y = &m_y[node.index];
+        const float *z = &m_z[node.index];
+        const float *radius = &m_radius[node.index];
+        for (uint32_t i = 0; i < node.count; ++i)
+        {
+            float ox = ray.start.x - x[i];
+            float oy = ray.start.y - y[i];
+            float oz = ray.start.z - z[i];
+            float b = ray.direction.x * ox + ray.direction.y * oy + ray.direction.z * oz;
+            float c = ox * ox + oy * oy + oz * oz - radius[i] * radius[i];
+            float discriminant = b * b - c;
+            float entry = -b - std::sqrt(std::max(discriminant, 0.0f));
+            t[i] = discriminant >= 0.0f && entry > MIN_SPHERE_HIT_T ? entry : std::numeric_limits<float>::infinity();
+        }
+
+        for (uint32_t i = 0; i < node.count; ++i)
+        {
+            if (t[i] < closestT)
+            {
+                closestT = t[i];
+                closest = node.index + i;
+                hit = true;
+            }
+        }
+    }
+
+    if (!hit)
+    {
+        return Intersection();
+    }
+
+    return intersectWithSphere(ray, glm::vec3(m_x[closest], m_y[closest], m_z[closest]), m_radius[closest]);
+}
+
+glm::vec3 SphereCloud::samplePoint()
+{
+    if (m_x.empty())
+    {
+        return glm::vec3(0);
+    }
+
+    // A uniform point on a random sphere
+    size_t sphere = std::min<size_t>(uniform01(gen) * m_x.size(), m_x.size() - 1);
+    float theta = 2.0f * M_PI * uniform01(gen);
+    float phi = acos(2.0f * uniform01(gen) - 1.0f);
+    glm::vec3 direction(sin(phi) * cos(theta), sin(phi) * sin(theta), cos(phi));
+    return glm::vec3(m_x[sphere], m_y[sphere], m_z[sphere]) + m_radius[sphere] * direction;
+}
+
+glm::vec3 SphereCloud::getCenter()
+{
+    return getBounds().center();
+}
+
+AABB SphereCloud::getBounds()
+{
+    return m_nodes.empty() ? AABB() : m_nodes[0].bounds;
+}
+
+size_t SphereCloud::size() const
+{
+    return m_x.size();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "Primitive.hpp"
+
+// A large number of spheres in one primitive. The centres and radii are stored as flat arrays
+// (structure of arrays), sorted along a Morton curve so that the spheres in each leaf of the
+// internal BVH are contiguous.
+class SphereCloud : public Primitive
+{
+public:
+  // positions holds x, y, z for each sphere. radii holds one radius per sphere, or a single radius for all of them.
+  SphereCloud(const std::vector<float> &positions, const std::vector<float> &radii);
+  virtual ~SphereCloud();
+  virtual Intersection intersect(const Ray &ray) override;
+  virtual glm::vec3 samplePoint() override;
+  virtual glm::vec3 getCenter() override;
+  virtual AABB getBounds() override;
+
+  size_t size() const;
+
+private:
+  struct Node
+  {
+    AABB bounds;
+    // For inner nodes, the index of the right child (the left child directly follows its parent).
+    // For leaves, the index of the first sphere.
+    uint32_t index;
+    // The number of spheres in a leaf, or 0 for inner nodes
+    uint32_t count;
+  };
+
+  uint32_t build(const std::vector<uint64_t> &keys, uint32_t begin, uint32_t end);
+
+  std::vector<float> m_x;
+  std::vector<float> m_y;
+  std::vector<float> m_z;
+  std::vector<float> m_radius;
+  std::vector<Node> m_nodes;
+};
@@ -0,0 +1,21 @@
+#include "AssetLoader.hpp"
+
+#include "ThreadPool.hpp"
+
+// Created on first use, after the pool that it runs on, so that it is destroyed (which waits for any
+// loads that are still running) before the pool
+static TaskGroup &assetLoads()
+{
+    static TaskGroup loads;
+    return loads;
+}
+
+void loadAssetAsync(std::function<void()> load)
+{
+    assetLoads().run(std::move(load));
+}
+
+void finishAssetLoads()
+{
+    assetLoads().wait();
+}
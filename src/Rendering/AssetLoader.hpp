@@ -0,0 +1,11 @@
+#pragma once
+
+#include <functional>
+
+// Queue a task that loads an asset (parses a mesh, decodes a texture) on the thread pool, so that the
+// scene script keeps running while it loads and many assets load at once. Nothing may use the asset
+// until the loads are finished.
+void loadAssetAsync(std::function<void()> load);
+
+// Wait for every queued load. Rethrows the first exception thrown by a load.
+void finishAssetLoads();
@@ -0,0 +1,96 @@
+#include "Denoiser.hpp"
+#include "ThreadPool.hpp"
+
+#include <cmath>
+
+// The B3 spline kernel used by the a-trous wavelet transform
+static const float KERNEL[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+// How strongly differences in normal stop the filter (higher is stricter)
+static const float NORMAL_POWER = 64.0f;
+
+// The allowed relative depth difference between neighbouring pixels
+static const float DEPTH_SIGMA = 0.05f;
+
+DenoiseGuides::DenoiseGuides(size_t width_, size_t height_)
+    : width(width_), height(height_),
+      normals(width_ * height_, glm::vec3(0.0f)),
+      depths(width_ * height_, 0.0f),
+      objectIds(width_ * height_, -1)
+{
+}
+
+// Run a single a-trous iteration, where the kernel taps are step pixels apart
+static void filterIteration(const std::vector<float> &input, std::vector<float> &output, const DenoiseGuides &guides, int step)
+{
+    int width = guides.width;
+    int height = guides.height;
+
+    // Every row only reads from the input, so the rows can be filtered in parallel
+    ThreadPool::global().parallelFor(0, height, [&](size_t row)
+                                     {
+        int y = row;
+        for (int x = 0; x < width; ++x)
+        {
+            size_t index = y * width + x;
+            int objectId = guides.objectIds[index];
+
+            // Nothing to filter on the background
+            if (objectId < 0)
+            {
+                output[index] = input[index];
+                continue;
+            }
+
+            glm::vec3 normal = guides.normals[index];
+            float depth = guides.depths[index];
+
+            float sum = 0.0f;
+            float totalWeight = 0.0f;
+            for (int j = -2; j <= 2; ++j)
+            {
+                int sampleY = y + j * step;
+                if (sampleY < 0 || sampleY >= height)
+                {
+                    continue;
+                }
+
+                for (int i = -2; i <= 2; ++i)
+                {
+                    int sampleX = x + i * step;
+                    if (sampleX < 0 || sampleX >= width)
+                    {
+                        continue;
+                    }
+
+                    size_t sampleIndex = sampleY * width + sampleX;
+
+                    // Never blur across different objects, including different instances of the same prototype
+                    if (guides.objectIds[sampleIndex] != objectId)
+                    {
+                        continue;
+                    }
+
+                    float normalWeight = std::pow(glm::max(0.0f, glm::dot(normal, guides.normals[sampleIndex])), NORMAL_POWER);
+                    float depthDifference = std::abs(depth - guides.depths[sampleIndex]) / glm::max(depth, 1e-4f);
+                    float depthWeight = std::exp(-depthDifference / (DEPTH_SIGMA * step));
+
+                    float weight = KERNEL[i + 2] * KERNEL[j + 2] * normalWeight * depthWeight;
+                    sum += weight * input[sampleIndex];
+                    totalWeight += weight;
+                }
+            }
+
+            output[index] = totalWeight > 0 ? sum / totalWeight : input[index];
+        } });
+}
+
+void denoise(std::vector<float> &values, const DenoiseGuides &guides, int iterations)
+{
+    std::vector<float> filtered(values.size());
+    for (int i = 0; i < iterations; ++i)
+    {
+        filterIteration(values, filtered, guides, 1 << i);
+        values.swap(filtered);
+    }
+}
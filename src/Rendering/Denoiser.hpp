@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Per-pixel information about the primary hit, used to stop the filter at geometric edges
+struct DenoiseGuides
+{
+    DenoiseGuides(size_t width, size_t height);
+
+    size_t width;
+    size_t height;
+    std::vector<glm::vec3> normals;
+    std::vector<float> depths;
+    // The id of the object that was hit (see SurfacePoint::objectId), or -1 for the background
+    std::vector<int> objectIds;
+};
+
+// Filter a single channel image (e.g. the visibility of an area light) in place, using an
+// edge-aware a-trous wavelet filter. Every iteration doubles the footprint of the filter.
+void denoise(std::vector<float> &values, const DenoiseGuides &guides, int iterations);
@@ -0,0 +1,759 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "Distributed.hpp"
+#include "RenderingThreadPool.hpp"
+#include "Telemetry.hpp"
+
+// Messages are a header followed by a payload of 32 bit words, in the byte order of the sender.
+// The processes must therefore all run on machines with the same byte order.
+enum MessageType : uint32_t
+{
+    // Worker to coordinator: render index, width, height, thread count
+    MESSAGE_READY = 1,
+    // Coordinator to worker: render index, tile index, x0, y0, x1, y1
+    MESSAGE_TILE,
+    // Worker to coordinator: render index, tile index, then the RGB floats of every pixel in the tile
+    MESSAGE_RESULT,
+    // Coordinator to worker: render index. The image is finished, so the worker moves on.
+    MESSAGE_DONE
+};
+
+struct MessageHeader
+{
+    uint32_t type;
+    // The size of the payload, in words
+    uint32_t size;
+};
+
+// Larger messages are treated as a broken connection
+const uint32_t MAX_MESSAGE_WORDS = 16 * 1024 * 1024;
+
+// How long the coordinator waits for the rest of a message that has started to arrive
+const int RECEIVE_TIMEOUT_SECONDS = 5;
+
+// How long a worker keeps trying to connect to a coordinator that is not listening yet
+const double CONNECT_TIMEOUT_SECONDS = 10.0;
+
+// The coordinator keeps this many tiles in flight for every thread of a worker, to hide the latency
+const size_t TILES_IN_FLIGHT_PER_THREAD = 2;
+
+// A worker process, as seen by the coordinator
+struct RemoteWorker
+{
+    int socket;
+    // The render index the worker is waiting for tiles of, if any
+    bool ready = false;
+    uint32_t ready_render = 0;
+    uint32_t threads = 1;
+    // The tiles that have been handed to this worker and not returned yet
+    std::vector<size_t> tiles;
+};
+
+static DistributedOptions distributed_options;
+static int listen_socket = -1;
+static int coordinator_socket = -1;
+static std::vector<pid_t> local_workers;
+static std::vector<std::unique_ptr<RemoteWorker>> remote_workers;
+
+// Every process counts its gr.render calls, so that the coordinator and workers agree on which image is which
+static uint32_t render_index = 0;
+
+static bool writeAll(int fd, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *data, size_t size)
+{
+    char *bytes = static_cast<char *>(data);
+    while (size > 0)
+    {
+        ssize_t count = read(fd, bytes, size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+static bool sendMessage(int fd, MessageType type, const std::vector<uint32_t> &words, const std::vector<float> &floats = {})
+{
+    MessageHeader header = {type, (uint32_t)(words.size() + floats.size())};
+
+    // Send the message with a single write, so that it is not split into several packets
+    std::vector<char> buffer(sizeof(header) + header.size * sizeof(uint32_t));
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    std::memcpy(buffer.data() + sizeof(header), words.data(), words.size() * sizeof(uint32_t));
+    std::memcpy(buffer.data() + sizeof(header) + words.size() * sizeof(uint32_t), floats.data(), floats.size() * sizeof(float));
+    return writeAll(fd, buffer.data(), buffer.size());
+}
+
+static bool receiveMessage(int fd, uint32_t &type, std::vector<uint32_t> &payload)
+{
+    MessageHeader header;
+    if (!readAll(fd, &header, sizeof(header)) || header.size > MAX_MESSAGE_WORDS)
+    {
+        return false;
+    }
+
+    type = header.type;
+    payload.resize(header.size);
+    return readAll(fd, payload.data(), header.size * sizeof(uint32_t));
+}
+
+// Split "[host:]port" into its parts
+static void splitAddress(const std::string &address, std::string &host, std::string &port)
+{
+    size_t colon = address.rfind(':');
+    host = colon == std::string::npos ? "" : address.substr(0, colon);
+    port = colon == std::string::npos ? address : address.substr(colon + 1);
+}
+
+static bool isUnixAddress(const std::string &address)
+{
+    return address.compare(0, 5, "unix:") == 0;
+}
+
+static sockaddr_un unixSocketAddress(const std::string &address)
+{
+    std::string path = address.substr(5);
+    sockaddr_un socket_address = {};
+    socket_address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(socket_address.sun_path))
+    {
+        throw std::runtime_error("Unix socket path is too long: " + path);
+    }
+    std::strcpy(socket_address.sun_path, path.c_str());
+    return socket_address;
+}
+
+// Listen on the address, and return the address that workers on this machine should connect to
+static std::string listenOn(const std::string &address)
+{
+    if (isUnixAddress(address))
+    {
+        sockaddr_un socket_address = unixSocketAddress(address);
+        unlink(socket_address.sun_path);
+
+        listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_socket < 0 || bind(listen_socket, (sockaddr *)&socket_address, sizeof(socket_address)) < 0 || listen(listen_socket, SOMAXCONN) < 0)
+        {
+            throw std::runtime_error("Could not listen on " + address + ": " + std::strerror(errno));
+        }
+        return address;
+    }
+
+    std::string host, port;
+    splitAddress(address, host, port);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *result = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0)
+    {
+        throw std::runtime_error("Could not resolve " + address);
+    }
+
+    listen_socket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    int reuse = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    bool listening = listen_socket >= 0 && bind(listen_socket, result->ai_addr, result->ai_addrlen) == 0 && listen(listen_socket, SOMAXCONN) == 0;
+    freeaddrinfo(result);
+    if (!listening)
+    {
+        throw std::runtime_error("Could not listen on " + address + ": " + std::strerror(errno));
+    }
+
+    // Find out which port we got, in case any port was allowed
+    sockaddr_in bound_address = {};
+    socklen_t bound_size = sizeof(bound_address);
+    getsockname(listen_socket, (sockaddr *)&bound_address, &bound_size);
+    return (host.empty() || host == "0.0.0.0" ? "127.0.0.1" : host) + ":" + std::to_string(ntohs(bound_address.sin_port));
+}
+
+static int tryConnect(const std::string &address)
+{
+    if (isUnixAddress(address))
+    {
+        sockaddr_un socket_address = unixSocketAddress(address);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (sockaddr *)&socket_address, sizeof(socket_address)) == 0)
+        {
+            return fd;
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    std::string host, port;
+    splitAddress(address, host, port);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    if (getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &result) != 0)
+    {
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo *info = result; info != nullptr && fd < 0; info = info->ai_next)
+    {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd >= 0 && connect(fd, info->ai_addr, info->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (fd >= 0)
+    {
+        // Results are sent as soon as they are done, so don't hold them back to fill packets
+        int no_delay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    }
+    return fd;
+}
+
+// Start a worker process that connects back to us. Its output is discarded, apart from warnings.
+static void spawnWorker(const std::string &connect_address)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw std::runtime_error(std::string("Could not start a worker: ") + std::strerror(errno));
+    }
+
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, STDOUT_FILENO);
+        }
+
+        // argv[0] is only a path if we were not found through the PATH, so prefer the binary itself
+        const std::string &executable = distributed_options.executable;
+        execl("/proc/self/exe", executable.c_str(), distributed_options.scene_file.c_str(), "--connect", connect_address.c_str(), (char *)nullptr);
+        execlp(executable.c_str(), executable.c_str(), distributed_options.scene_file.c_str(), "--connect", connect_address.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+
+    local_workers.push_back(pid);
+}
+
+// Warn about local workers that have exited. They only exit once the sockets are closed, so any that exit
+// before then could not be started or connect, and their share of the tiles is rendered by the others.
+static void checkLocalWorkers()
+{
+    for (size_t i = 0; i < local_workers.size();)
+    {
+        int status;
+        if (waitpid(local_workers[i], &status, WNOHANG) != local_workers[i])
+        {
+            ++i;
+            continue;
+        }
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+        {
+            std::cerr << "WARNING: local worker " << local_workers[i] << " could not be started from " << distributed_options.executable << std::endl;
+        }
+        else if (WIFSIGNALED(status))
+        {
+            std::cerr << "WARNING: local worker " << local_workers[i] << " was killed by signal " << WTERMSIG(status) << std::endl;
+        }
+        else
+        {
+            std::cerr << "WARNING: local worker " << local_workers[i] << " exited early with status " << WEXITSTATUS(status) << std::endl;
+        }
+        local_workers.erase(local_workers.begin() + i);
+    }
+}
+
+void startDistributed(const DistributedOptions &options)
+{
+    distributed_options = options;
+
+    // A worker that goes away must not kill the coordinator (or the other way around)
+    signal(SIGPIPE, SIG_IGN);
+
+    if (options.role == DistributedRole::Coordinator)
+    {
+        std::string connect_address = listenOn(options.address);
+        std::cout << "Listening for workers on " << connect_address << std::endl;
+
+        for (int i = 0; i < options.spawn_workers; ++i)
+        {
+            spawnWorker(connect_address);
+        }
+    }
+    else if (options.role == DistributedRole::Worker)
+    {
+        // The coordinator may still be starting up
+        auto start = std::chrono::steady_clock::now();
+        while ((coordinator_socket = tryConnect(options.address)) < 0)
+        {
+            if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > CONNECT_TIMEOUT_SECONDS)
+            {
+                throw std::runtime_error("Could not connect to the coordinator at " + options.address);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        std::cout << "Connected to the coordinator at " << options.address << std::endl;
+    }
+}
+
+void stopDistributed()
+{
+    for (std::unique_ptr<RemoteWorker> &worker : remote_workers)
+    {
+        close(worker->socket);
+    }
+    remote_workers.clear();
+
+    if (coordinator_socket >= 0)
+    {
+        close(coordinator_socket);
+        coordinator_socket = -1;
+    }
+
+    if (listen_socket >= 0)
+    {
+        close(listen_socket);
+        listen_socket = -1;
+        if (isUnixAddress(distributed_options.address))
+        {
+            unlink(distributed_options.address.substr(5).c_str());
+        }
+    }
+
+    // The local workers see the sockets close once they are done with the scene
+    for (pid_t pid : local_workers)
+    {
+        waitpid(pid, nullptr, 0);
+    }
+    local_workers.clear();
+}
+
+DistributedRole distributedRole()
+{
+    return distributed_options.role;
+}
+
+// Render the tiles the coordinator hands out on the thread pool, until it says the image is done
+static void renderAsWorker(Image &image, const std::function<glm::vec3(uint32_t, uint32_t)> &pixelFunction)
+{
+    uint32_t index = render_index++;
+    uint32_t threads = ThreadPool::global().size();
+    if (!sendMessage(coordinator_socket, MESSAGE_READY, {index, image.width(), image.height(), threads}))
+    {
+        throw std::runtime_error("Lost the connection to the coordinator");
+    }
+
+    std::mutex send_mutex;
+    TaskGroup tasks;
+    while (true)
+    {
+        uint32_t type;
+        std::vector<uint32_t> payload;
+        if (!receiveMessage(coordinator_socket, type, payload) || payload.empty())
+        {
+            tasks.wait();
+            throw std::runtime_error("Lost the connection to the coordinator");
+        }
+
+        // Anything left over from an earlier image is ignored
+        if (payload[0] != index)
+        {
+            continue;
+        }
+
+        if (type == MESSAGE_DONE)
+        {
+            break;
+        }
+
+        if (type == MESSAGE_TILE && payload.size() == 6)
+        {
+            uint32_t tile_index = payload[1];
+            Tile tile = {payload[2], payload[3], payload[4], payload[5]};
+            tasks.run([&, tile_index, tile]()
+                      {
+                std::vector<float> colours;
+                colours.reserve(3 * (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+                forEachPixel(tile, [&](uint32_t x, uint32_t y)
+                             {
+                    glm::vec3 colour = pixelFunction(x, y);
+                    colours.push_back(colour.r);
+                    colours.push_back(colour.g);
+                    colours.push_back(colour.b); });
+                addTelemetry(PixelsDone, (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+
+                std::lock_guard<std::mutex> lock(send_mutex);
+                sendMessage(coordinator_socket, MESSAGE_RESULT, {index, tile_index}, colours); });
+        }
+    }
+
+    // Results for tiles the coordinator no longer needs are ignored on its side
+    tasks.wait();
+}
+
+// Hand out the tiles to the workers that are ready for this image, render tiles locally as well, and
+// assemble the results. Tiles of workers that disconnect or take too long are handed out again.
+static void renderAsCoordinator(Image &image, const RenderMetadata &metadata, const std::function<glm::vec3(uint32_t, uint32_t)> &pixelFunction)
+{
+    enum class TileState
+    {
+        Pending,
+        Assigned,
+        Done
+    };
+
+    struct TileStatus
+    {
+        TileState state = TileState::Pending;
+        std::chrono::steady_clock::time_point assigned_at;
+        // Whether a local thread is rendering (or has rendered) this tile
+        bool local = false;
+    };
+
+    uint32_t index = render_index++;
+    std::vector<Tile> tiles = RenderingThreadPool::makeTiles(image.width(), image.height());
+    std::vector<TileStatus> status(tiles.size());
+    std::deque<size_t> pending;
+    for (size_t t = 0; t < tiles.size(); ++t)
+    {
+        pending.push_back(t);
+    }
+    size_t done_count = 0;
+    std::mutex mutex;
+
+    TelemetryReporter reporter(image.width() * image.height(), 1.0);
+
+    size_t remote_count = 0;
+
+    // Copy a finished tile into the image, unless another copy of it got there first. Must hold the mutex.
+    auto commitTile = [&](size_t t, const float *colours, bool remote)
+    {
+        if (status[t].state == TileState::Done)
+        {
+            return;
+        }
+        remote_count += remote;
+
+        const Tile &tile = tiles[t];
+        forEachPixel(tile, [&](uint32_t x, uint32_t y)
+                     {
+            image(x, y, 0) = (double)colours[0];
+            image(x, y, 1) = (double)colours[1];
+            image(x, y, 2) = (double)colours[2];
+            colours += 3; });
+        status[t].state = TileState::Done;
+        done_count++;
+        addTelemetry(PixelsDone, (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+    };
+
+    // The coordinator renders tiles itself too. Once nothing is pending, local threads help with the
+    // tiles that workers have had the longest, in case those workers are slow or gone.
+    TaskGroup local;
+    for (size_t i = 0; i < std::max<size_t>(metadata.thread_count, 1); ++i)
+    {
+        local.run([&]()
+                  {
+            while (true)
+            {
+                size_t t = tiles.size();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!pending.empty())
+                    {
+                        t = pending.front();
+                        pending.pop_front();
+                        status[t].state = TileState::Assigned;
+                        status[t].assigned_at = std::chrono::steady_clock::now();
+                    }
+                    else
+                    {
+                        for (size_t candidate = 0; candidate < tiles.size(); ++candidate)
+                        {
+                            if (status[candidate].state == TileState::Assigned && !status[candidate].local &&
+                                (t == tiles.size() || status[candidate].assigned_at < status[t].assigned_at))
+                            {
+                                t = candidate;
+                            }
+                        }
+                    }
+
+                    if (t == tiles.size())
+                    {
+                        return;
+                    }
+                    status[t].local = true;
+                }
+
+                std::vector<float> colours;
+                forEachPixel(tiles[t], [&](uint32_t x, uint32_t y)
+                             {
+                    glm::vec3 colour = pixelFunction(x, y);
+                    colours.push_back(colour.r);
+                    colours.push_back(colour.g);
+                    colours.push_back(colour.b); });
+
+                std::lock_guard<std::mutex> lock(mutex);
+                commitTile(t, colours.data(), false);
+            } });
+    }
+
+    auto dropWorker = [&](size_t w)
+    {
+        std::cerr << "WARNING: lost a worker, handing its tiles out again" << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t t : remote_workers[w]->tiles)
+            {
+                if (status[t].state == TileState::Assigned && !status[t].local)
+                {
+                    status[t].state = TileState::Pending;
+                    pending.push_front(t);
+                }
+            }
+        }
+        close(remote_workers[w]->socket);
+        remote_workers.erase(remote_workers.begin() + w);
+    };
+
+    auto handleMessage = [&](RemoteWorker &worker, uint32_t type, const std::vector<uint32_t> &payload)
+    {
+        if (type == MESSAGE_READY && payload.size() == 4)
+        {
+            worker.ready = true;
+            worker.ready_render = payload[0];
+            worker.threads = std::max<uint32_t>(payload[3], 1);
+            worker.tiles.clear();
+
+            // Workers that are behind skip the images they missed
+            bool matches = payload[1] == image.width() && payload[2] == image.height();
+            if (payload[0] < index || (payload[0] == index && !matches))
+            {
+                if (payload[0] == index)
+                {
+                    std::cerr << "WARNING: a worker has a different image size, so it is skipped" << std::endl;
+                }
+                worker.ready = false;
+                return sendMessage(worker.socket, MESSAGE_DONE, {payload[0]});
+            }
+        }
+        else if (type == MESSAGE_RESULT && payload.size() >= 2 && payload[0] == index && payload[1] < tiles.size())
+        {
+            size_t t = payload[1];
+            worker.tiles.erase(std::remove(worker.tiles.begin(), worker.tiles.end(), t), worker.tiles.end());
+
+            const Tile &tile = tiles[t];
+            if (payload.size() != 2 + 3 * (tile.x1 - tile.x0) * (tile.y1 - tile.y0))
+            {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            commitTile(t, reinterpret_cast<const float *>(payload.data() + 2), true);
+        }
+        return true;
+    };
+
+    // Workers that connected and got ready before this image are handled like they just did
+    for (size_t w = 0; w < remote_workers.size();)
+    {
+        RemoteWorker &worker = *remote_workers[w];
+        if (worker.ready && !handleMessage(worker, MESSAGE_READY, {worker.ready_render, image.width(), image.height(), worker.threads}))
+        {
+            dropWorker(w);
+            continue;
+        }
+        ++w;
+    }
+
+    std::chrono::duration<double> tile_timeout(distributed_options.tile_timeout);
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (done_count == tiles.size())
+            {
+                break;
+            }
+        }
+
+        std::vector<pollfd> fds(1 + remote_workers.size());
+        fds[0] = {listen_socket, POLLIN, 0};
+        for (size_t w = 0; w < remote_workers.size(); ++w)
+        {
+            fds[1 + w] = {remote_workers[w]->socket, POLLIN, 0};
+        }
+        poll(fds.data(), fds.size(), 50);
+        checkLocalWorkers();
+
+        // Read from the existing workers first, since the indices into fds change as workers come and go
+        for (size_t w = remote_workers.size(); w-- > 0;)
+        {
+            if (fds[1 + w].revents == 0)
+            {
+                continue;
+            }
+
+            uint32_t type;
+            std::vector<uint32_t> payload;
+            if (!receiveMessage(remote_workers[w]->socket, type, payload) || payload.empty() || !handleMessage(*remote_workers[w], type, payload))
+            {
+                dropWorker(w);
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept(listen_socket, nullptr, nullptr);
+            if (fd >= 0)
+            {
+                timeval timeout = {RECEIVE_TIMEOUT_SECONDS, 0};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                int no_delay = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+                std::unique_ptr<RemoteWorker> worker = std::make_unique<RemoteWorker>();
+                worker->socket = fd;
+                remote_workers.push_back(std::move(worker));
+            }
+        }
+
+        // Hand out the tiles of workers that take too long again
+        auto now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t t = 0; t < tiles.size(); ++t)
+            {
+                if (status[t].state == TileState::Assigned && !status[t].local && now - status[t].assigned_at > tile_timeout)
+                {
+                    std::cerr << "WARNING: tile " << t << " timed out, handing it out again" << std::endl;
+                    status[t].state = TileState::Pending;
+                    pending.push_back(t);
+                }
+            }
+        }
+
+        // Keep every ready worker busy
+        for (size_t w = 0; w < remote_workers.size();)
+        {
+            RemoteWorker &worker = *remote_workers[w];
+            bool connected = true;
+            while (connected && worker.ready && worker.ready_render == index && worker.tiles.size() < TILES_IN_FLIGHT_PER_THREAD * worker.threads)
+            {
+                size_t t;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (pending.empty())
+                    {
+                        break;
+                    }
+                    t = pending.front();
+                    pending.pop_front();
+                    status[t].state = TileState::Assigned;
+                    status[t].assigned_at = now;
+                }
+
+                const Tile &tile = tiles[t];
+                worker.tiles.push_back(t);
+                connected = sendMessage(worker.socket, MESSAGE_TILE, {index, (uint32_t)t, tile.x0, tile.y0, tile.x1, tile.y1});
+            }
+
+            if (!connected)
+            {
+                dropWorker(w);
+                continue;
+            }
+            ++w;
+        }
+    }
+
+    // Let the workers move on to the next image
+    for (size_t w = 0; w < remote_workers.size();)
+    {
+        RemoteWorker &worker = *remote_workers[w];
+        if (worker.ready && worker.ready_render == index)
+        {
+            worker.ready = false;
+            worker.tiles.clear();
+            if (!sendMessage(worker.socket, MESSAGE_DONE, {index}))
+            {
+                dropWorker(w);
+                continue;
+            }
+        }
+        ++w;
+    }
+
+    local.wait();
+    reporter.stop();
+    std::cout << remote_count << " of " << tiles.size() << " tiles were rendered by " << remote_workers.size() << " worker(s)" << std::endl;
+}
+
+void renderDistributed(Image &image, const RenderMetadata &metadata, const std::function<glm::vec3(uint32_t, uint32_t)> &pixelFunction)
+{
+    if (distributed_options.role == DistributedRole::Worker)
+    {
+        renderAsWorker(image, pixelFunction);
+    }
+    else
+    {
+        renderAsCoordinator(image, metadata, pixelFunction);
+    }
+}
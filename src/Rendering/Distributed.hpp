@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <glm/glm.hpp>
+
+#include "Image.hpp"
+#include "../Lua/scene_lua.hpp"
+
+// How this process takes part in rendering an image across several processes
+enum class DistributedRole
+{
+    // Render everything in this process
+    None,
+    // Hand out tiles to the workers (and render tiles locally), and assemble the image
+    Coordinator,
+    // Render the tiles that the coordinator hands out, and send them back
+    Worker
+};
+
+struct DistributedOptions
+{
+    DistributedRole role = DistributedRole::None;
+    // "unix:<path>" for a Unix socket, or "[host:]port" for TCP. The coordinator listens on this address
+    // (a TCP port of 0 picks a free port), and workers connect to it.
+    std::string address;
+    // The number of local worker processes the coordinator starts
+    int spawn_workers = 0;
+    // The argv[0] of this process. Local workers are started from /proc/self/exe, or from this (searched
+    // for in the PATH) where that does not exist.
+    std::string executable;
+    std::string scene_file;
+    // Tiles that a worker has not returned after this many seconds are handed out again
+    double tile_timeout = 10.0;
+};
+
+// Set up the sockets (and start any local workers). Throws std::runtime_error if that fails.
+void startDistributed(const DistributedOptions &options);
+
+// Close the sockets and wait for any local workers to exit
+void stopDistributed();
+
+DistributedRole distributedRole();
+
+// Render the image with the workers. Every process that takes part calls this for the same gr.render
+// calls in the same order. The coordinator ends up with the full image, and workers with none of it.
+void renderDistributed(Image &image, const RenderMetadata &metadata, const std::function<glm::vec3(uint32_t, uint32_t)> &pixelFunction);
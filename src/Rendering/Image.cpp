@@ -17,13 +17,17 @@ Image::Image()
 //---------------------------------------------------------------------------------------
 Image::Image(
 	uint width,
-	uint height)
+	uint height,
+	bool clear)
 	: m_width(width),
 	  m_height(height)
 {
 	size_t numElements = m_width * m_height * m_colorComponents;
 	m_data = new double[numElements];
-	memset(m_data, 0, numElements * sizeof(double));
+	if (clear)
+	{
+		memset(m_data, 0, numElements * sizeof(double));
+	}
 }
 
 //---------------------------------------------------------------------------------------
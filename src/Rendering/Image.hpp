@@ -18,8 +18,9 @@ public:
 	// Construct an empty image.
 	Image();
 
-	// Construct a black image at the given width/height.
-	Image(uint width, uint height);
+	// Construct a black image at the given width/height. If clear is false, the
+	// pixels are left uninitialized (and the memory is not touched yet).
+	Image(uint width, uint height, bool clear = true);
 
 	// Construct an image from the given PNG file.
 	Image(const std::string &filename);
@@ -1,47 +1,56 @@
 #include <glm/ext.hpp>
 
 #include "RayTracer.hpp"
+#include "Telemetry.hpp"
 #include "../Modeling/GeometryNode.hpp"
 #include "../Modeling/BooleanNode.hpp"
+#include "../Modeling/InstanceNode.hpp"
 
 const float MIN_REFLECTION_WEIGHT = 0.05;
 
+// Below this cosine between the ray and the surface, textures are not filtered any more than at this angle
+const float MIN_FOOTPRINT_COSINE = 0.01f;
+
 // The main ray tracing function. This is called for each pixel in the image, as well as recursive rays.
 glm::vec3 trace(
-    SceneNode *root,
+    const SceneBVH &scene,
     const Ray &ray,
     const glm::vec3 &ambient,
     const std::list<Light *> &lights,
     const std::list<GeometryNode *> &areaLights,
     const std::function<glm::vec3(const Ray &)> backgroundFunction,
-    float weight)
+    float weight,
+    const QualitySettings &quality)
 
 {
     // Check if we have intersected with the scene
-    Intersection intersection = intersectWithScene(root, ray);
+    Intersection intersection = intersectWithScene(scene, ray);
 
     if (!intersection.isValid || ray.getT(intersection.entry.position) < 0)
     {
         return backgroundFunction(ray);
     }
 
-    // If we have, we want to calculate the lighting for this point
-    SurfacePoint &surfacePoint = intersection.entry;
-    SurfacePoint &exitPoint = intersection.exit;
+    return shade(scene, ray, intersection, ambient, lights, areaLights, backgroundFunction, weight, quality);
+}
 
-    glm::vec3 surfacePosition = surfacePoint.position;
+// Shade a ray that is already known to hit the scene. This does the lighting, shadows, and any recursive rays.
+glm::vec3 shade(
+    const SceneBVH &scene,
+    const Ray &ray,
+    Intersection &intersection,
+    const glm::vec3 &ambient,
+    const std::list<Light *> &lights,
+    const std::list<GeometryNode *> &areaLights,
+    const std::function<glm::vec3(const Ray &)> backgroundFunction,
+    float weight,
+    const QualitySettings &quality)
+{
+    // We want to calculate the lighting for this point
+    SurfacePoint &surfacePoint = intersection.entry;
 
     // Cast a shadow ray to each point light source
-    std::list<std::tuple<Light *, float>> visibleLights;
-    for (Light *light : lights)
-    {
-        Ray shadowRay(surfacePosition, glm::normalize(light->position - surfacePosition));
-        float lightContribution = getLightContribution(root, shadowRay, light->position, nullptr);
-        if (lightContribution > 0)
-        {
-            visibleLights.push_back(std::make_tuple(light, lightContribution));
-        }
-    }
+    std::list<std::tuple<Light *, float>> visibleLights = getVisiblePointLights(scene, surfacePoint.position, lights);
 
     // Calculate how visible this point is to the area lights
     for (GeometryNode *node : areaLights)
@@ -51,15 +60,7 @@ glm::vec3 trace(
             continue;
         }
 
-        float averageLightContribution = 0;
-        for (int i = 0; i < node->m_emission_samples; ++i)
-        {
-            glm::vec3 randomPoint = glm::vec3(node->totalHierarchyTransform * glm::vec4(node->m_primitive->samplePoint(), 1.0f));
-            Ray shadowRay(surfacePosition, glm::normalize(randomPoint - surfacePosition));
-            averageLightContribution += getLightContribution(root, shadowRay, randomPoint, node);
-        }
-
-        averageLightContribution /= node->m_emission_samples;
+        float averageLightContribution = getAreaLightContribution(scene, surfacePoint.position, node, quality.emissionSampleScale);
         if (averageLightContribution > 0)
         {
             Light *light = node->m_emission;
@@ -70,25 +71,146 @@ glm::vec3 trace(
     // Get the surface color based on all the visible lights
     glm::vec3 surfaceColor = calculateLighting(ray, surfacePoint, ambient, visibleLights);
 
-    // Potentially add transparency and reflection
-    double transparency = surfacePoint.node->m_material->getTransparency();
+    return addSecondaryRays(scene, ray, intersection, surfaceColor, ambient, lights, areaLights, backgroundFunction, weight, quality);
+}
+
+// Shade a ray like shade(), but keep the area light visibility separate from the rest of the colour. The final
+// colour is secondary + surfaceWeight * clamp(surface + sum(visibility[i] * areaLightTerms[i])), which lets the
+// (noisy) visibility be filtered later. The surface colour is only clamped once the lights are added back, since
+// the lighting is only linear in the visibility before it is clamped.
+SeparatedShading shadeSeparated(
+    const SceneBVH &scene,
+    const Ray &ray,
+    Intersection &intersection,
+    const glm::vec3 &ambient,
+    const std::list<Light *> &lights,
+    const std::list<GeometryNode *> &areaLights,
+    const std::function<glm::vec3(const Ray &)> backgroundFunction)
+{
+    SurfacePoint &surfacePoint = intersection.entry;
+    std::list<std::tuple<Light *, float>> visibleLights = getVisiblePointLights(scene, surfacePoint.position, lights);
+
+    // The surface color as if every area light was occluded
+    glm::vec3 baseColor = calculateUnclampedLighting(ray, surfacePoint, ambient, visibleLights);
+
+    // The secondary rays mix in the surface colour linearly, so without one they give the rest of the colour
+    SeparatedShading result;
+    result.surface = baseColor;
+    result.secondary = addSecondaryRays(scene, ray, intersection, glm::vec3(0.0f), ambient, lights, areaLights, backgroundFunction, 1.0f);
+
+    // The surface color only makes up part of the final colour if we have transparency or reflections
+    const Material *material = surfacePoint.material;
+    float surfaceWeight = 1.0f;
+    if (material->getTransparency() > 0)
+    {
+        surfaceWeight *= 1 - material->getTransparency();
+    }
+    if (material->getReflectivity() > MIN_REFLECTION_WEIGHT)
+    {
+        surfaceWeight *= 1 - material->getReflectivity();
+    }
+    result.surfaceWeight = surfaceWeight;
+
+    for (GeometryNode *node : areaLights)
+    {
+        if (node == surfacePoint.node)
+        {
+            result.visibilities.push_back(0.0f);
+            result.areaLightTerms.push_back(glm::vec3(0.0f));
+            continue;
+        }
+
+        // The unclamped lighting is linear in the visibility, so the term is the extra colour if the light were fully visible
+        std::list<std::tuple<Light *, float>> unoccludedLights = visibleLights;
+        unoccludedLights.push_back(std::make_tuple(node->m_emission, 1.0f));
+        glm::vec3 unoccludedColor = calculateUnclampedLighting(ray, surfacePoint, ambient, unoccludedLights);
+
+        result.visibilities.push_back(getAreaLightContribution(scene, surfacePoint.position, node));
+        result.areaLightTerms.push_back(unoccludedColor - baseColor);
+    }
+
+    return result;
+}
+
+// Cast a shadow ray to each point light source, and return the lights that are (partially) visible
+std::list<std::tuple<Light *, float>> getVisiblePointLights(const SceneBVH &scene, const glm::vec3 &surfacePosition, const std::list<Light *> &lights)
+{
+    std::list<std::tuple<Light *, float>> visibleLights;
+    for (Light *light : lights)
+    {
+        Ray shadowRay(surfacePosition, glm::normalize(light->position - surfacePosition));
+        addTelemetry(ShadowRays);
+        float lightContribution = getLightContribution(scene, shadowRay, light->position, nullptr);
+        if (lightContribution > 0)
+        {
+            visibleLights.push_back(std::make_tuple(light, lightContribution));
+        }
+    }
+
+    return visibleLights;
+}
+
+// Calculate how visible a point is to an area light, by sampling random points on the light
+float getAreaLightContribution(const SceneBVH &scene, const glm::vec3 &surfacePosition, GeometryNode *node, float sampleScale)
+{
+    int sampleCount = glm::max(1, (int)glm::round(node->m_emission_samples * sampleScale));
+    float averageLightContribution = 0;
+    for (int i = 0; i < sampleCount; ++i)
+    {
+        glm::vec3 randomPoint = glm::vec3(node->totalHierarchyTransform * glm::vec4(node->m_primitive->samplePoint(), 1.0f));
+        Ray shadowRay(surfacePosition, glm::normalize(randomPoint - surfacePosition));
+        addTelemetry(ShadowRays);
+        averageLightContribution += getLightContribution(scene, shadowRay, randomPoint, node);
+    }
+
+    return averageLightContribution / sampleCount;
+}
+
+// Potentially add transparency and reflection on top of the surface color
+glm::vec3 addSecondaryRays(
+    const SceneBVH &scene,
+    const Ray &ray,
+    Intersection &intersection,
+    glm::vec3 surfaceColor,
+    const glm::vec3 &ambient,
+    const std::list<Light *> &lights,
+    const std::list<GeometryNode *> &areaLights,
+    const std::function<glm::vec3(const Ray &)> backgroundFunction,
+    float weight,
+    const QualitySettings &quality)
+{
+    SurfacePoint &surfacePoint = intersection.entry;
+    SurfacePoint &exitPoint = intersection.exit;
+
+    if (quality.maxDepth <= 0)
+    {
+        return surfaceColor;
+    }
+
+    QualitySettings nextQuality = quality;
+    nextQuality.maxDepth--;
+
+    double transparency = surfacePoint.material->getTransparency();
     if (transparency > 0)
     {
-        Ray transmissionRay(exitPoint.position, ray.direction);
-        glm::vec3 transmissionColor = trace(root, transmissionRay, ambient, lights, areaLights, backgroundFunction, transparency * weight);
+        Ray transmissionRay(exitPoint.position, ray.direction, ray.getConeWidth(ray.getT(exitPoint.position)), ray.coneSpread);
+        addTelemetry(TransmissionRays);
+        glm::vec3 transmissionColor = trace(scene, transmissionRay, ambient, lights, areaLights, backgroundFunction, transparency * weight, nextQuality);
         surfaceColor = (1 - transparency) * surfaceColor + transparency * transmissionColor;
     }
 
-    float reflectivity = surfacePoint.node->m_material->getReflectivity();
+    float reflectivity = surfacePoint.material->getReflectivity();
     if (reflectivity * weight > MIN_REFLECTION_WEIGHT)
     {
         glm::vec3 reflectionDirection = glm::normalize(ray.direction - 2 * glm::dot(ray.direction, surfacePoint.normal) * surfacePoint.normal);
-        Ray reflectionRay(surfacePosition, reflectionDirection);
+        // Curvature is ignored, so the cone keeps spreading like it did before the reflection
+        Ray reflectionRay(surfacePoint.position, reflectionDirection, ray.getConeWidth(ray.getT(surfacePoint.position)), ray.coneSpread);
+        addTelemetry(ReflectionRays);
         std::function<glm::vec3(const Ray &)> reflectionBackgroundFunction = [&ambient](const Ray &backgroundRay)
         {
             return ambient;
         };
-        glm::vec3 reflectionColor = trace(root, reflectionRay, ambient, lights, areaLights, reflectionBackgroundFunction, reflectivity * weight);
+        glm::vec3 reflectionColor = trace(scene, reflectionRay, ambient, lights, areaLights, reflectionBackgroundFunction, reflectivity * weight, nextQuality);
         surfaceColor = (1 - reflectivity) * surfaceColor + reflectivity * reflectionColor;
     }
 
@@ -96,20 +218,9 @@ glm::vec3 trace(
 }
 
 // Helper method to intersect with the scene
-Intersection intersectWithScene(const SceneNode *root, const Ray &ray)
+Intersection intersectWithScene(const SceneBVH &scene, const Ray &ray)
 {
-    std::vector<Intersection> intersection = traverseNode(root, ray);
-    Intersection result;
-
-    for (Intersection &i : intersection)
-    {
-        if (!result.isValid || ray.getT(i.entry.position) < ray.getT(result.entry.position))
-        {
-            result = i;
-        }
-    }
-
-    return result;
+    return scene.intersect(ray);
 }
 
 // Recursive function that performs a hierarchical traversal of the scene.
@@ -127,19 +238,66 @@ std::vector<Intersection> traverseNode(const SceneNode *node, const Ray &ray)
 
     for (Intersection &i : result)
     {
-        // Now that we have the result, we need to transform the position, normal, and tangent back up
-        i.entry.position = glm::vec3(node->trans * glm::vec4(i.entry.position, 1.0f));
-        i.exit.position = glm::vec3(node->trans * glm::vec4(i.exit.position, 1.0f));
-        i.entry.normal = glm::normalize(node->transpose_inv_trans * i.entry.normal);
-        i.entry.tangent = glm::normalize(node->transpose_inv_trans * i.entry.tangent);
-        i.exit.normal = glm::normalize(node->transpose_inv_trans * i.exit.normal);
-        i.exit.tangent = glm::normalize(node->transpose_inv_trans * i.exit.tangent);
+        transformIntersection(i, node->trans, node->transpose_inv_trans);
     }
 
     return result;
 }
 
+// Transform the position, normal, and tangent of an intersection from the local space of a node back up
+void transformIntersection(Intersection &i, const glm::mat4 &transform, const glm::mat3 &normalTransform)
+{
+    i.entry.position = glm::vec3(transform * glm::vec4(i.entry.position, 1.0f));
+    i.exit.position = glm::vec3(transform * glm::vec4(i.exit.position, 1.0f));
+
+    // How much the transform scales areas on the surface, from |det(M)| |M^-T n| (Nanson's formula)
+    float volumeScale = std::abs(glm::determinant(glm::mat3(transform)));
+    glm::vec3 entryNormal = normalTransform * i.entry.normal;
+    glm::vec3 exitNormal = normalTransform * i.exit.normal;
+    i.entry.uvScale /= std::sqrt(volumeScale * glm::length(entryNormal));
+    i.exit.uvScale /= std::sqrt(volumeScale * glm::length(exitNormal));
+
+    i.entry.normal = glm::normalize(entryNormal);
+    i.entry.tangent = glm::normalize(normalTransform * i.entry.tangent);
+    i.exit.normal = glm::normalize(exitNormal);
+    i.exit.tangent = glm::normalize(normalTransform * i.exit.tangent);
+}
+
+// Shade the intersection with the material of an instance instead of that of the prototype
+void applyMaterialOverride(Intersection &intersection, const Material *material)
+{
+    if (material != nullptr)
+    {
+        intersection.entry.material = material;
+        intersection.exit.material = material;
+    }
+}
+
 std::vector<Intersection> computeNodeIntersection(const SceneNode *node, const Ray &ray)
+{
+    std::vector<Intersection> result = computeLeafIntersection(node, ray);
+
+    // The children of a CSG node are only hit as part of it
+    if (node->m_nodeType == NodeType::BooleanNode)
+    {
+        return result;
+    }
+
+    // Try intersecting with all child nodes
+    for (SceneNode *child : node->children)
+    {
+        std::vector<Intersection> intersections = traverseNode(child, ray);
+        for (Intersection &intersection : intersections)
+        {
+            result.push_back(intersection);
+        }
+    }
+
+    return result;
+}
+
+// Intersect with a node itself, without its children (apart from the ones that make up a CSG node, or the prototype of an instance)
+std::vector<Intersection> computeLeafIntersection(const SceneNode *node, const Ray &ray)
 {
     // If we have a boolean node, then we need to perform CSG
     if (node->m_nodeType == NodeType::BooleanNode)
@@ -148,6 +306,18 @@ std::vector<Intersection> computeNodeIntersection(const SceneNode *node, const R
         return performCSGIntersection(booleanNode, ray);
     }
 
+    // Instances that are part of a CSG tree walk their prototype, since the CSG needs every intersection
+    if (node->m_nodeType == NodeType::InstanceNode)
+    {
+        const InstanceNode *instanceNode = static_cast<const InstanceNode *>(node);
+        std::vector<Intersection> result = traverseNode(instanceNode->m_prototype, ray);
+        for (Intersection &intersection : result)
+        {
+            applyMaterialOverride(intersection, instanceNode->m_material);
+        }
+        return result;
+    }
+
     std::vector<Intersection> result;
 
     // Now, we're not a CSG node
@@ -163,21 +333,13 @@ std::vector<Intersection> computeNodeIntersection(const SceneNode *node, const R
             {
                 intersection.entry.node = geometryNode;
                 intersection.exit.node = geometryNode;
+                intersection.entry.material = geometryNode->m_material;
+                intersection.exit.material = geometryNode->m_material;
                 result.push_back(intersection);
             }
         }
     }
 
-    // Try intersecting with all child nodes
-    for (SceneNode *child : node->children)
-    {
-        std::vector<Intersection> intersections = traverseNode(child, ray);
-        for (Intersection &intersection : intersections)
-        {
-            result.push_back(intersection);
-        }
-    }
-
     return result;
 }
 
@@ -316,13 +478,13 @@ std::vector<Intersection> performCSGIntersection(const BooleanNode *node, const
 }
 
 // Get how "visible" the light is at a certain point. This is used to calculate shadows
-float getLightContribution(const SceneNode *root, const Ray &ray, const glm::vec3 &lightPosition, const SceneNode *target)
+float getLightContribution(const SceneBVH &scene, const Ray &ray, const glm::vec3 &lightPosition, const SceneNode *target)
 {
     float contribution = 1.0f;
     Ray currentRay = ray;
     while (true)
     {
-        Intersection shadowIntersection = intersectWithScene(root, currentRay);
+        Intersection shadowIntersection = intersectWithScene(scene, currentRay);
         if (!shadowIntersection.isValid)
         {
             return contribution;
@@ -343,9 +505,9 @@ float getLightContribution(const SceneNode *root, const Ray &ray, const glm::vec
                 return contribution;
             }
             // if not, we may need to continue based on the transparency of the object
-            else if (shadowSurfacePoint.node->m_material->getTransparency() > 0)
+            else if (shadowSurfacePoint.material->getTransparency() > 0)
             {
-                contribution *= shadowSurfacePoint.node->m_material->getTransparency();
+                contribution *= shadowSurfacePoint.material->getTransparency();
                 currentRay = Ray(shadowExitPoint.position, currentRay.direction);
             }
             else
@@ -356,40 +518,46 @@ float getLightContribution(const SceneNode *root, const Ray &ray, const glm::vec
     }
 }
 
-// Use a Phong illumination model to calculate the lighting at a certain point. This also handles texture/normal maps.
+// Use a Phong illumination model to calculate the lighting at a certain point, clamped to [0, 1]
 glm::vec3 calculateLighting(
     const Ray &ray,
     SurfacePoint &surfacePoint,
     const glm::vec3 &ambient,
     const std::list<std::tuple<Light *, float>> &lights)
+{
+    return glm::clamp(calculateUnclampedLighting(ray, surfacePoint, ambient, lights), 0.0f, 1.0f);
+}
+
+// Use a Phong illumination model to calculate the lighting at a certain point. This also handles texture/normal maps.
+glm::vec3 calculateUnclampedLighting(
+    const Ray &ray,
+    SurfacePoint &surfacePoint,
+    const glm::vec3 &ambient,
+    const std::list<std::tuple<Light *, float>> &lights)
 {
     const GeometryNode *surface = surfacePoint.node;
     glm::vec3 surfacePosition = surfacePoint.position;
     glm::vec3 surfaceNormal = surfacePoint.normal;
 
+    // The width of the ray cone where it hits the surface, in texture coordinates. The cone is stretched
+    // along the surface when it hits it at an angle. Using the geometric mean of the stretched and
+    // unstretched widths avoids blurring surfaces seen at grazing angles too much.
+    float cosine = glm::max(std::abs(glm::dot(ray.direction, surfaceNormal)), MIN_FOOTPRINT_COSINE);
+    float footprint = ray.getConeWidth(ray.getT(surfacePosition)) * surfacePoint.uvScale / std::sqrt(cosine);
+
     glm::vec3 surfaceColor;
     if (surface->m_texture)
     {
-        float xCoord = glm::min(surfacePoint.uv.x * surface->m_texture->width(), (float)surface->m_texture->width() - 1);
-        float yCoord = glm::min(surfacePoint.uv.y * surface->m_texture->height(), (float)surface->m_texture->height() - 1);
-        double textureR = (*surface->m_texture)(xCoord, yCoord, 0);
-        double textureG = (*surface->m_texture)(xCoord, yCoord, 1);
-        double textureB = (*surface->m_texture)(xCoord, yCoord, 2);
-        surfaceColor = glm::vec3(textureR, textureG, textureB);
+        surfaceColor = surface->m_texture->sample(surfacePoint.uv, footprint);
     }
     else
     {
-        surfaceColor = surface->m_material->getKd();
+        surfaceColor = surfacePoint.material->getKd();
     }
 
     if (surface->m_normal)
     {
-        float xCoord = surfacePoint.uv.x * (surface->m_normal->width() - 1);
-        float yCoord = surfacePoint.uv.y * (surface->m_normal->height() - 1);
-        double normalR = ((*surface->m_normal)(xCoord, yCoord, 0) * 2) - 1;
-        double normalG = ((*surface->m_normal)(xCoord, yCoord, 1) * 2) - 1;
-        double normalB = ((*surface->m_normal)(xCoord, yCoord, 2) * 2) - 1;
-        glm::vec3 perturbed_normal = glm::normalize(glm::vec3(normalR, normalG, normalB));
+        glm::vec3 perturbed_normal = surface->m_normal->sample(surfacePoint.uv, footprint);
 
         glm::vec3 bitangent = glm::normalize(glm::cross(surfaceNormal, surfacePoint.tangent));
 
@@ -420,7 +588,7 @@ glm::vec3 calculateLighting(
         glm::vec3 r = -l + 2 * glm::dot(l, n) * n;
         float dotRV = glm::dot(r, v);
         float dotNL = glm::dot(n, l);
-        glm::vec3 shininess = surface->m_material->getKs() * glm::pow(dotRV, surface->m_material->getShininess()) / dotNL;
+        glm::vec3 shininess = surfacePoint.material->getKs() * glm::pow(dotRV, surfacePoint.material->getShininess()) / dotNL;
         if (shininess.r < 0 || shininess.g < 0 || shininess.b < 0)
         {
             shininess = glm::vec3(0.0f);
@@ -434,9 +602,5 @@ glm::vec3 calculateLighting(
         finalColor += contribution;
     }
 
-    finalColor.r = glm::max(0.0f, glm::min(finalColor.r, 1.0f));
-    finalColor.g = glm::max(0.0f, glm::min(finalColor.g, 1.0f));
-    finalColor.b = glm::max(0.0f, glm::min(finalColor.b, 1.0f));
-
     return finalColor;
 }
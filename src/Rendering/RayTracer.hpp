@@ -1,31 +1,108 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <limits>
 #include "../Modeling/SceneNode.hpp"
 #include "../Modeling/BooleanNode.hpp"
 #include "../Modeling/Light.hpp"
 #include "../Modeling/Primitive.hpp"
+#include "SceneBVH.hpp"
+
+// The shading of a surface, with the visibility of each area light kept separate
+struct SeparatedShading
+{
+    // The colour of the reflections and transmission, which is everything that does not come from the surface itself
+    glm::vec3 secondary;
+    // How much of the final colour the surface makes up
+    float surfaceWeight;
+    // The surface colour with every area light fully occluded, before it is clamped
+    glm::vec3 surface;
+    // The colour each area light adds to the surface when it is fully visible, before it is clamped
+    std::vector<glm::vec3> areaLightTerms;
+    // How visible each area light is, in [0, 1]
+    std::vector<float> visibilities;
+};
+
+// Settings that trade image quality for render time. The defaults give the full quality.
+struct QualitySettings
+{
+    // Whether a pixel may take more than one sample
+    bool allowSupersampling = true;
+    // Scales the number of samples taken of each area light (at least one sample is always taken)
+    float emissionSampleScale = 1.0f;
+    // How many reflection and transmission bounces may still be traced
+    int maxDepth = std::numeric_limits<int>::max();
+};
 
 glm::vec3 trace(
-    SceneNode *root,
+    const SceneBVH &scene,
+    const Ray &ray,
+    const glm::vec3 &ambient,
+    const std::list<Light *> &lights,
+    const std::list<GeometryNode *> &areaLights,
+    const std::function<glm::vec3(const Ray &)> backgroundFunction,
+    float weight,
+    const QualitySettings &quality = QualitySettings());
+
+glm::vec3 shade(
+    const SceneBVH &scene,
+    const Ray &ray,
+    Intersection &intersection,
+    const glm::vec3 &ambient,
+    const std::list<Light *> &lights,
+    const std::list<GeometryNode *> &areaLights,
+    const std::function<glm::vec3(const Ray &)> backgroundFunction,
+    float weight,
+    const QualitySettings &quality = QualitySettings());
+
+SeparatedShading shadeSeparated(
+    const SceneBVH &scene,
     const Ray &ray,
+    Intersection &intersection,
+    const glm::vec3 &ambient,
+    const std::list<Light *> &lights,
+    const std::list<GeometryNode *> &areaLights,
+    const std::function<glm::vec3(const Ray &)> backgroundFunction);
+
+std::list<std::tuple<Light *, float>> getVisiblePointLights(const SceneBVH &scene, const glm::vec3 &surfacePosition, const std::list<Light *> &lights);
+
+float getAreaLightContribution(const SceneBVH &scene, const glm::vec3 &surfacePosition, GeometryNode *node, float sampleScale = 1.0f);
+
+glm::vec3 addSecondaryRays(
+    const SceneBVH &scene,
+    const Ray &ray,
+    Intersection &intersection,
+    glm::vec3 surfaceColor,
     const glm::vec3 &ambient,
     const std::list<Light *> &lights,
     const std::list<GeometryNode *> &areaLights,
     const std::function<glm::vec3(const Ray &)> backgroundFunction,
-    float weight);
+    float weight,
+    const QualitySettings &quality = QualitySettings());
 
-Intersection intersectWithScene(const SceneNode *root, const Ray &ray);
+Intersection intersectWithScene(const SceneBVH &scene, const Ray &ray);
 
 std::vector<Intersection> traverseNode(const SceneNode *node, const Ray &ray);
 
+void transformIntersection(Intersection &intersection, const glm::mat4 &transform, const glm::mat3 &normalTransform);
+
+void applyMaterialOverride(Intersection &intersection, const Material *material);
+
 std::vector<Intersection> computeNodeIntersection(const SceneNode *node, const Ray &ray);
 
+std::vector<Intersection> computeLeafIntersection(const SceneNode *node, const Ray &ray);
+
 std::vector<Intersection> performCSGIntersection(const BooleanNode *node, const Ray &ray);
 
-float getLightContribution(const SceneNode *root, const Ray &ray, const glm::vec3 &lightPosition, const SceneNode *target);
+float getLightContribution(const SceneBVH &scene, const Ray &ray, const glm::vec3 &lightPosition, const SceneNode *target);
 
 glm::vec3 calculateLighting(
+    const Ray &ray,
+    SurfacePoint &surfacePoint,
+    const glm::vec3 &ambient,
+    const std::list<std::tuple<Light *, float>> &lights);
+
+glm::vec3 calculateUnclampedLighting(
     const Ray &ray,
     SurfacePoint &surfacePoint,
     const glm::vec3 &ambient,
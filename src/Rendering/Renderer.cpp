@@ -1,14 +1,180 @@
 #include <glm/ext.hpp>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <set>
 
 #include "Renderer.hpp"
 #include "RayTracer.hpp"
 #include "RenderingThreadPool.hpp"
+#include "Denoiser.hpp"
+#include "Telemetry.hpp"
+#include "Distributed.hpp"
+#include "TextureCache.hpp"
+#include "AssetLoader.hpp"
 #include "../Modeling/GeometryNode.hpp"
 #include "../Modeling/BooleanNode.hpp"
+#include "../Modeling/InstanceNode.hpp"
+
+// The stride of the first (coarsest) progressive pass, which renders 1 in 8 x 8 pixels
+const uint32_t PROGRESSIVE_START_STRIDE = 8;
+
+// The stride of the pixels that are timed to predict the cost of each tile, which samples 1 in 4 x 4 pixels
+const uint32_t COST_PREDICTION_STRIDE = 4;
 
 void Render(SceneNode *root, Image &image, const RenderMetadata &metadata)
+{
+	if (metadata.pin_threads && !ThreadPool::global().pinThreads())
+	{
+		std::cerr << "WARNING: could not pin the render threads to cores" << std::endl;
+	}
+
+	// Decode the background image on the thread pool while we prepare the scene
+	std::future<std::unique_ptr<Image>> background_future = loadBackgroundImage(metadata);
+
+	// The meshes and textures that the scene script started loading
+	finishAssetLoads();
+
+	SceneBVH scene;
+	scene.setAutoInstancing(metadata.enable_auto_instancing);
+	std::list<GeometryNode *> areaLights = prepareScene(root, scene);
+	printRenderInfo(root, image, metadata);
+
+	std::unique_ptr<Image> background_image;
+	if (background_future.valid())
+	{
+		// Wait for the background image
+		background_image = background_future.get();
+	}
+
+	renderImage(scene, image, metadata, background_image, areaLights);
+	TextureCache::global().printStatistics();
+}
+
+// Render the frames of an animation, which share the scene and every asset that was loaded for it.
+// If there is an update function, it is called before each frame to change the scene, and the frames
+// are rendered one after another. Otherwise only the camera moves, and several frames are rendered at
+// once on the thread pool. Saving a frame overlaps with rendering the next ones.
+void Animate(SceneNode *root, int frameStart, int frameEnd, const std::function<RenderMetadata(int)> &frameMetadata, const std::function<void(int)> &update)
+{
+	if (frameEnd < frameStart)
+	{
+		return;
+	}
+
+	// Every frame uses the settings (apart from the camera and image name) of the first one
+	RenderMetadata first = frameMetadata(frameStart);
+	if (first.pin_threads && !ThreadPool::global().pinThreads())
+	{
+		std::cerr << "WARNING: could not pin the render threads to cores" << std::endl;
+	}
+
+	std::future<std::unique_ptr<Image>> background_future = loadBackgroundImage(first);
+	finishAssetLoads();
+	std::unique_ptr<Image> background_image;
+	if (background_future.valid())
+	{
+		background_image = background_future.get();
+	}
+
+	// Workers of a distributed render do not save images, and must see the frames in order
+	bool saveImages = distributedRole() != DistributedRole::Worker;
+	std::vector<std::future<void>> saves;
+
+	// Kept across the frames, so that frames which only move nodes refit it instead of building it again
+	SceneBVH scene;
+	scene.setAutoInstancing(first.enable_auto_instancing);
+
+	if (!update && distributedRole() == DistributedRole::None)
+	{
+		std::list<GeometryNode *> areaLights = prepareScene(root, scene);
+
+		std::vector<RenderMetadata> frames = {first};
+		for (int frame = frameStart + 1; frame <= frameEnd; ++frame)
+		{
+			frames.push_back(frameMetadata(frame));
+		}
+
+		// The progress of every render is measured from the shared counters, so the frames report it together
+		for (RenderMetadata &metadata : frames)
+		{
+			metadata.report_progress = false;
+		}
+		TelemetryReporter reporter((uint64_t)frames.size() * first.image_width * first.image_height, 1.0);
+
+		// Render as many frames at once as there are threads. Each frame only needs its own image.
+		size_t batchSize = ThreadPool::global().size();
+		for (size_t batchStart = 0; batchStart < frames.size(); batchStart += batchSize)
+		{
+			TaskGroup batch;
+			for (size_t i = batchStart; i < glm::min(batchStart + batchSize, frames.size()); ++i)
+			{
+				batch.run([&, i]()
+						  {
+					const RenderMetadata &metadata = frames[i];
+					std::cout << "Rendering frame " << frameStart + (int)i << " to " << metadata.image_name << std::endl;
+					Image image(metadata.image_width, metadata.image_height, !metadata.pin_threads);
+					renderImage(scene, image, metadata, background_image, areaLights);
+					image.savePng(metadata.image_name); });
+			}
+			batch.wait();
+		}
+		reporter.stop();
+		TextureCache::global().printStatistics();
+		return;
+	}
+
+	for (int frame = frameStart; frame <= frameEnd; ++frame)
+	{
+		if (update)
+		{
+			// The update may load more assets
+			update(frame);
+			finishAssetLoads();
+		}
+
+		// The transforms may have changed, so gather the world transforms and lights again
+		std::list<GeometryNode *> areaLights = prepareScene(root, scene);
+		RenderMetadata metadata = frame == frameStart ? first : frameMetadata(frame);
+
+		std::cout << "Rendering frame " << frame << " to " << metadata.image_name << std::endl;
+		std::shared_ptr<Image> image = std::make_shared<Image>(metadata.image_width, metadata.image_height, !metadata.pin_threads);
+		renderImage(scene, *image, metadata, background_image, areaLights);
+
+		if (saveImages)
+		{
+			std::string filename = metadata.image_name;
+			saves.push_back(ThreadPool::global().submit([image, filename]()
+														{ image->savePng(filename); }));
+		}
+	}
+
+	for (std::future<void> &save : saves)
+	{
+		save.get();
+	}
+	TextureCache::global().printStatistics();
+}
+
+// Start decoding the background image of the metadata on the thread pool, if it has one
+std::future<std::unique_ptr<Image>> loadBackgroundImage(const RenderMetadata &metadata)
+{
+	std::future<std::unique_ptr<Image>> background_future;
+	if (metadata.background_image != "")
+	{
+		std::string filename = metadata.background_image;
+		background_future = ThreadPool::global().submit([filename]()
+														{ return std::make_unique<Image>(filename); });
+	}
+	return background_future;
+}
+
+// Compute the world transform of every node and the position of every area light, check that the scene is valid,
+// and bring the acceleration structure up to date. Returns the area lights.
+std::list<GeometryNode *> prepareScene(SceneNode *root, SceneBVH &scene)
 {
 	std::list<GeometryNode *> areaLights;
+	std::set<std::pair<const SceneNode *, bool>> checkedPrototypes;
 	std::stack<std::tuple<SceneNode *, glm::mat4>> stack;
 	stack.push(std::make_tuple(root, glm::mat4(1.0f)));
 	while (!stack.empty())
@@ -48,6 +214,11 @@ void Render(SceneNode *root, Image &image, const RenderMetadata &metadata)
 				throw std::runtime_error("BooleanNode has incorrect number of children");
 			}
 		}
+		else if (node->m_nodeType == NodeType::InstanceNode)
+		{
+			InstanceNode *instanceNode = static_cast<InstanceNode *>(node);
+			checkPrototype(instanceNode->m_prototype, instanceNode->m_material != nullptr, checkedPrototypes);
+		}
 
 		for (SceneNode *child : node->children)
 		{
@@ -55,6 +226,53 @@ void Render(SceneNode *root, Image &image, const RenderMetadata &metadata)
 		}
 	}
 
+	scene.update(root);
+	return areaLights;
+}
+
+// Check that a prototype can be rendered. Every instance shares the prototype, so each one is only checked once
+// (for instances with and without a material of their own).
+void checkPrototype(const SceneNode *node, bool hasMaterial, std::set<std::pair<const SceneNode *, bool>> &checked)
+{
+	if (!checked.insert(std::make_pair(node, hasMaterial)).second)
+	{
+		return;
+	}
+
+	if (node->m_nodeType == NodeType::GeometryNode)
+	{
+		const GeometryNode *geometryNode = static_cast<const GeometryNode *>(node);
+		if (!geometryNode->m_material && !hasMaterial)
+		{
+			std::cerr << "WARNING: GeometryNode " << geometryNode->m_name << " has no material" << std::endl;
+			throw std::runtime_error("GeometryNode has no material");
+		}
+
+		if (geometryNode->m_emission != nullptr)
+		{
+			std::cerr << "WARNING: the emission of " << geometryNode->m_name << " does not light the scene, since it is part of an instance" << std::endl;
+		}
+	}
+	else if (node->m_nodeType == NodeType::BooleanNode && node->children.size() != 2)
+	{
+		std::cerr << "WARNING: BooleanNode " << node->m_name << " has " << node->children.size() << " children" << std::endl;
+		throw std::runtime_error("BooleanNode has incorrect number of children");
+	}
+	else if (node->m_nodeType == NodeType::InstanceNode)
+	{
+		const InstanceNode *instanceNode = static_cast<const InstanceNode *>(node);
+		checkPrototype(instanceNode->m_prototype, hasMaterial || instanceNode->m_material != nullptr, checked);
+	}
+
+	for (const SceneNode *child : node->children)
+	{
+		checkPrototype(child, hasMaterial, checked);
+	}
+}
+
+// Print the scene and the render settings
+void printRenderInfo(SceneNode *root, const Image &image, const RenderMetadata &metadata)
+{
 	std::cout << "F24: Calling Render for " << metadata.image_name << "(\n"
 			  << "\t" << *root << "\t" << "Image(width:" << image.width() << ", height:" << image.height() << ")\n"
 																											  "\t"
@@ -71,48 +289,502 @@ void Render(SceneNode *root, Image &image, const RenderMetadata &metadata)
 	}
 	std::cout << "\t}" << std::endl;
 	std::cout << "\t" << "enable_supersampling: " << metadata.enable_supersampling << std::endl;
+	std::cout << "\t" << "enable_sample_grouping: " << metadata.enable_sample_grouping << std::endl;
+	std::cout << "\t" << "enable_cost_prediction: " << metadata.enable_cost_prediction << std::endl;
+	std::cout << "\t" << "enable_auto_instancing: " << metadata.enable_auto_instancing << std::endl;
+	std::cout << "\t" << "enable_progressive: " << metadata.enable_progressive << std::endl;
+	std::cout << "\t" << "enable_denoising: " << metadata.enable_denoising << std::endl;
 	std::cout << "\t" << "thread_count: " << metadata.thread_count << std::endl;
+	std::cout << "\t" << "pin_threads: " << metadata.pin_threads << std::endl;
+	std::cout << "\t" << "time_budget: " << metadata.time_budget << std::endl;
 	std::cout << ")" << std::endl;
+}
 
-	std::unique_ptr<Image> background_image;
-	if (metadata.background_image != "")
+// Render the image of a prepared scene, with the renderer that the metadata asks for
+void renderImage(const SceneBVH &scene, Image &image, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights)
+{
+	size_t h = image.height();
+	size_t w = image.width();
+
+	if (distributedRole() != DistributedRole::None)
+	{
+		if (!metadata.enable_denoising && !metadata.enable_progressive && metadata.time_budget <= 0)
+		{
+			renderDistributed(image, metadata, [&](uint32_t x, uint32_t y)
+							  { return getPixelColor(scene, x, y, metadata, background_image, areaLights); });
+			return;
+		}
+
+		// The coordinator renders these images on its own
+		std::cerr << "WARNING: distributed rendering only supports the standard renderer, so " << metadata.image_name << " is rendered locally" << std::endl;
+		if (distributedRole() == DistributedRole::Worker)
+		{
+			return;
+		}
+	}
+
+	if (metadata.time_budget > 0 && (metadata.enable_denoising || metadata.enable_progressive))
+	{
+		std::cerr << "WARNING: a time budget is not supported together with progressive rendering or denoising, so it is ignored" << std::endl;
+	}
+
+	if (metadata.enable_denoising)
+	{
+		if (metadata.enable_progressive)
+		{
+			std::cerr << "WARNING: progressive rendering is not supported together with denoising, so it is disabled" << std::endl;
+		}
+
+		renderDenoised(scene, image, metadata, background_image, areaLights);
+		return;
+	}
+
+	if (metadata.enable_progressive)
+	{
+		renderProgressive(scene, image, metadata, background_image, areaLights);
+		return;
+	}
+
+	if (metadata.time_budget > 0)
+	{
+		renderWithDeadline(scene, image, metadata, background_image, areaLights);
+		return;
+	}
+
+	// Hand out the expensive tiles first if we can predict them, so that no thread is left with a slow tile at the end
+	std::unique_ptr<RenderingThreadPool> pool;
+	if (metadata.enable_cost_prediction)
+	{
+		pool = std::make_unique<RenderingThreadPool>(metadata.thread_count, w, h, estimateTileCosts(scene, metadata, background_image, areaLights));
+	}
+	else
 	{
-		// Load the background image
-		background_image = std::make_unique<Image>(metadata.background_image);
+		pool = std::make_unique<RenderingThreadPool>(metadata.thread_count, w, h);
 	}
 
+	auto tile_function = [&scene, &metadata, &image, &background_image, &areaLights](const Tile &tile)
+	{
+		forEachPixel(tile, [&](uint32_t x, uint32_t y)
+					 {
+			glm::vec3 colour = getPixelColor(scene, x, y, metadata, background_image, areaLights);
+
+			// Red:
+			image(x, y, 0) = (double)colour.r;
+			// Green:
+			image(x, y, 1) = (double)colour.g;
+			// Blue:
+			image(x, y, 2) = (double)colour.b; });
+	};
+
+	// With pinned threads the image is allocated without being cleared, and the pinned workers clear it
+	// here in bands of whole rows. The first thread to touch a page of memory decides where it is placed,
+	// so this spreads the image over the sockets instead of putting all of it on the allocating one. The
+	// tiles are not rendered by the worker that cleared them, so this balances the memory traffic rather
+	// than making it local. Every band is cleared before any tile is rendered.
+	if (metadata.pin_threads)
+	{
+		size_t band_rows = (h + ThreadPool::global().size() - 1) / ThreadPool::global().size();
+		ThreadPool::global().parallelFor(0, h, [&image, w](size_t y)
+										 {
+			for (size_t x = 0; x < w; ++x)
+			{
+				image(x, y, 0) = 0.0;
+				image(x, y, 1) = 0.0;
+				image(x, y, 2) = 0.0;
+			} }, band_rows);
+	}
+
+	// Render the image on the thread pool
+	pool->process(tile_function, metadata.report_progress);
+
+	// Wait for all tiles to finish
+	pool->join();
+}
+
+// Render the image in passes of increasing quality, writing preview images along the way.
+// The first passes render an interleaved subset of the pixels (1/64, 1/16, 1/4, then the rest),
+// and any later passes accumulate extra jittered samples into a floating point buffer.
+void renderProgressive(const SceneBVH &scene, Image &image, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights)
+{
 	size_t h = image.height();
 	size_t w = image.width();
 
-	RenderingThreadPool pool(metadata.thread_count, w, h);
+	std::vector<glm::vec3> accumulation(w * h, glm::vec3(0.0f));
+	std::vector<uint32_t> sampleCounts(w * h, 0);
 
-	auto pixel_function = [&root, &metadata, &image, &background_image, &areaLights](uint32_t x, uint32_t y)
+	auto lastPreview = std::chrono::steady_clock::now();
+	auto writePreview = [&image, &metadata, &lastPreview](const std::string &pass)
 	{
-		glm::vec3 colour = getPixelColor(root, x, y, metadata, background_image, areaLights);
+		auto now = std::chrono::steady_clock::now();
+		if (std::chrono::duration<double>(now - lastPreview).count() < metadata.preview_interval)
+		{
+			return;
+		}
+
+		image.savePng(metadata.image_name);
+		lastPreview = now;
+		std::cout << "Preview written to " << metadata.image_name << " after " << pass << std::endl;
+	};
 
-		// Red:
+	auto setPixel = [&image](uint32_t x, uint32_t y, const glm::vec3 &colour)
+	{
 		image(x, y, 0) = (double)colour.r;
-		// Green:
 		image(x, y, 1) = (double)colour.g;
-		// Blue:
 		image(x, y, 2) = (double)colour.b;
 	};
 
-	// Spawn threads to render the image
-	pool.process(pixel_function);
+	// Interleaved passes. Each pass renders the pixels on a grid of the given stride that were not
+	// rendered by a coarser pass, and fills the block it covers so that the preview has no holes.
+	for (uint32_t stride = PROGRESSIVE_START_STRIDE; stride >= 1; stride /= 2)
+	{
+		RenderingThreadPool pool(metadata.thread_count, w, h);
+		pool.process([&, stride](const Tile &tile)
+					 {
+			// Tiles start on a multiple of every stride, so we can step over the grid directly
+			for (uint32_t y = tile.y0; y < tile.y1; y += stride)
+			{
+				for (uint32_t x = tile.x0; x < tile.x1; x += stride)
+				{
+					if (stride < PROGRESSIVE_START_STRIDE && x % (2 * stride) == 0 && y % (2 * stride) == 0)
+					{
+						continue;
+					}
+
+					glm::vec3 colour = getPixelColor(scene, x, y, metadata, background_image, areaLights);
+					accumulation[y * w + x] = colour;
+					sampleCounts[y * w + x] = 1;
+
+					for (uint32_t blockY = y; blockY < glm::min(y + stride, tile.y1); ++blockY)
+					{
+						for (uint32_t blockX = x; blockX < glm::min(x + stride, tile.x1); ++blockX)
+						{
+							setPixel(blockX, blockY, colour);
+						}
+					}
+				}
+			} }, metadata.report_progress);
+
+		// Wait for the pass to finish before writing a preview
+		pool.join();
+		writePreview(stride == 1 ? "all of the pixels" : "1/" + std::to_string(stride * stride) + " of the pixels");
+	}
 
-	// Wait for all threads to finish (on destruction)
+	// Accumulation passes. Every pass adds one jittered sample to each pixel.
+	for (int sample = 1; sample <= metadata.progressive_samples; ++sample)
+	{
+		RenderingThreadPool pool(metadata.thread_count, w, h);
+		pool.process([&](const Tile &tile)
+					 { forEachPixel(tile, [&](uint32_t x, uint32_t y)
+									{
+				glm::vec2 pixel = glm::vec2(x, y) + getPixelJitter();
+				accumulation[y * w + x] += renderPixel(scene, pixel, metadata, background_image, areaLights);
+				sampleCounts[y * w + x]++;
+				setPixel(x, y, accumulation[y * w + x] / (float)sampleCounts[y * w + x]); }); }, metadata.report_progress);
+
+		pool.join();
+		writePreview(std::to_string(sample) + " accumulated sample(s) per pixel");
+	}
+}
+
+// Render the image with the visibility of each area light kept separate. The visibility is then filtered
+// with an edge-aware filter (guided by the normal, depth and node of the primary hit) before everything is
+// combined, which makes soft shadows from low emission sample counts look smooth.
+void renderDenoised(const SceneBVH &scene, Image &image, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights)
+{
+	size_t h = image.height();
+	size_t w = image.width();
+	size_t lightCount = areaLights.size();
+
+	// The surface colours and terms are weighted by how much of the colour the surface makes up, and are only
+	// clamped once the filtered visibility is put back in
+	DenoiseGuides guides(w, h);
+	std::vector<glm::vec3> secondaryColours(w * h, glm::vec3(0.0f));
+	std::vector<float> surfaceWeights(w * h, 0.0f);
+	std::vector<glm::vec3> surfaceColours(w * h, glm::vec3(0.0f));
+	std::vector<std::vector<glm::vec3>> areaLightTerms(lightCount, std::vector<glm::vec3>(w * h, glm::vec3(0.0f)));
+	std::vector<std::vector<float>> visibilities(lightCount, std::vector<float>(w * h, 0.0f));
+
+	std::vector<glm::vec2> offsets = {glm::vec2(0.0f)};
+	if (metadata.enable_supersampling)
+	{
+		offsets.clear();
+		for (float xOffset = -0.5f; xOffset <= 0.5f; xOffset += 0.5f)
+		{
+			for (float yOffset = -0.5f; yOffset <= 0.5f; yOffset += 0.5f)
+			{
+				offsets.push_back(glm::vec2(xOffset, yOffset));
+			}
+		}
+	}
+
+	std::function<glm::vec3(const Ray &)> backgroundFunction = getBackgroundFunction(metadata, background_image);
+
+	RenderingThreadPool pool(metadata.thread_count, w, h);
+	pool.process([&](const Tile &tile)
+				 { forEachPixel(tile, [&](uint32_t x, uint32_t y)
+								{
+			size_t index = y * w + x;
+			std::vector<float> visibilitySums(lightCount, 0.0f);
+			int hitCount = 0;
+
+			for (const glm::vec2 &offset : offsets)
+			{
+				Ray ray = getCameraRay(glm::vec2(x, y) + offset, metadata);
+				Intersection intersection = intersectWithScene(scene, ray);
+				if (!intersection.isValid || ray.getT(intersection.entry.position) < 0)
+				{
+					secondaryColours[index] += backgroundFunction(ray);
+					continue;
+				}
+
+				SeparatedShading shading = shadeSeparated(scene, ray, intersection, metadata.scene_ambient, metadata.scene_lights, areaLights, backgroundFunction);
+				secondaryColours[index] += shading.secondary;
+				surfaceWeights[index] += shading.surfaceWeight;
+				surfaceColours[index] += shading.surfaceWeight * shading.surface;
+				for (size_t i = 0; i < lightCount; ++i)
+				{
+					areaLightTerms[i][index] += shading.surfaceWeight * shading.areaLightTerms[i];
+					visibilitySums[i] += shading.visibilities[i];
+				}
+				hitCount++;
+
+				// The guides come from the sample in the center of the pixel
+				if (offset == glm::vec2(0.0f))
+				{
+					guides.normals[index] = intersection.entry.normal;
+					guides.depths[index] = ray.getT(intersection.entry.position);
+					guides.objectIds[index] = intersection.entry.objectId;
+				}
+			}
+
+			secondaryColours[index] /= (float)offsets.size();
+			surfaceWeights[index] /= (float)offsets.size();
+			surfaceColours[index] /= (float)offsets.size();
+			for (size_t i = 0; i < lightCount; ++i)
+			{
+				areaLightTerms[i][index] /= (float)offsets.size();
+				visibilities[i][index] = hitCount > 0 ? visibilitySums[i] / hitCount : 0.0f;
+			} }); }, metadata.report_progress);
+
+	pool.join();
+
+	for (std::vector<float> &visibility : visibilities)
+	{
+		denoise(visibility, guides, metadata.denoise_iterations);
+	}
+
+	ThreadPool::global().parallelFor(0, h, [&](size_t y)
+									 {
+		for (size_t x = 0; x < w; ++x)
+		{
+			size_t index = y * w + x;
+			glm::vec3 surface = surfaceColours[index];
+			for (size_t i = 0; i < lightCount; ++i)
+			{
+				surface += visibilities[i][index] * areaLightTerms[i][index];
+			}
+
+			// weight * clamp(colour, 0, 1) for the weighted surface colour
+			glm::vec3 colour = secondaryColours[index] + glm::clamp(surface, 0.0f, surfaceWeights[index]);
+
+			image(x, y, 0) = (double)colour.r;
+			image(x, y, 1) = (double)colour.g;
+			image(x, y, 2) = (double)colour.b;
+		} });
+}
+
+// Render the image within the time budget. Every tile is rendered at the best quality level that is predicted
+// to let the remaining tiles finish in time, based on how long the previous tiles took at each level.
+// The level that each tile reached is written to a quality map next to the image.
+void renderWithDeadline(const SceneBVH &scene, Image &image, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights)
+{
+	size_t h = image.height();
+	size_t w = image.width();
+	size_t tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+	size_t tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+	double parallelism = glm::max<size_t>(1, glm::min<size_t>(metadata.thread_count, ThreadPool::global().size()));
+
+	std::vector<QualityLevel> levels = getQualityLevels(metadata);
+	std::vector<size_t> tileLevels(tilesX * tilesY, 0);
+
+	std::mutex statsMutex;
+	std::vector<double> measuredSeconds(levels.size(), 0.0);
+	std::vector<size_t> measuredPixels(levels.size(), 0);
+	size_t pixelsLeft = w * h;
+
+	auto start = std::chrono::steady_clock::now();
+	auto secondsSince = [](std::chrono::steady_clock::time_point time)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - time).count();
+	};
+
+	// Predict the cost of a pixel by scaling the timing of the closest level that has been measured
+	auto estimatePixelCost = [&](size_t level)
+	{
+		for (size_t distance = 0; distance < levels.size(); ++distance)
+		{
+			for (size_t measured : {level - distance, level + distance})
+			{
+				if (measured < levels.size() && measuredPixels[measured] > 0)
+				{
+					double secondsPerPixel = measuredSeconds[measured] / measuredPixels[measured];
+					return secondsPerPixel * levels[level].expectedCost / levels[measured].expectedCost;
+				}
+			}
+		}
+
+		return 0.0;
+	};
+
+	// Pick the best level that finishes the remaining pixels in time, or the fastest level if none does
+	auto chooseLevel = [&]()
+	{
+		double secondsLeft = metadata.time_budget - secondsSince(start);
+		for (size_t level = 0; level < levels.size(); ++level)
+		{
+			if (pixelsLeft * estimatePixelCost(level) / parallelism <= secondsLeft)
+			{
+				return level;
+			}
+		}
+
+		return levels.size() - 1;
+	};
+
+	RenderingThreadPool pool(metadata.thread_count, w, h);
+	pool.process([&](const Tile &tile)
+				 {
+		size_t tilePixels = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+		size_t level;
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			level = chooseLevel();
+			pixelsLeft -= tilePixels;
+		}
+
+		auto tileStart = std::chrono::steady_clock::now();
+		forEachPixel(tile, [&](uint32_t x, uint32_t y)
+					 {
+			glm::vec3 colour = getPixelColor(scene, x, y, metadata, background_image, areaLights, levels[level].settings);
+			image(x, y, 0) = (double)colour.r;
+			image(x, y, 1) = (double)colour.g;
+			image(x, y, 2) = (double)colour.b; });
+		double seconds = secondsSince(tileStart);
+
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			measuredSeconds[level] += seconds;
+			measuredPixels[level] += tilePixels;
+		}
+		tileLevels[(tile.y0 / TILE_SIZE) * tilesX + tile.x0 / TILE_SIZE] = level; }, metadata.report_progress);
+
+	pool.join();
+
+	std::cout << "Rendered in " << secondsSince(start) << "s with a time budget of " << metadata.time_budget << "s" << std::endl;
+	for (size_t level = 0; level < levels.size(); ++level)
+	{
+		size_t tileCount = std::count(tileLevels.begin(), tileLevels.end(), level);
+		std::cout << "\t" << "quality level " << level << " (" << levels[level].description << "): " << tileCount << " tiles" << std::endl;
+	}
+
+	// Colour each tile from green (full quality) to red (fastest level)
+	Image qualityMap(w, h);
+	forEachPixel(Tile{0, 0, (uint32_t)w, (uint32_t)h}, [&](uint32_t x, uint32_t y)
+				 {
+		size_t level = tileLevels[(y / TILE_SIZE) * tilesX + x / TILE_SIZE];
+		double t = levels.size() > 1 ? (double)level / (levels.size() - 1) : 0.0;
+		qualityMap(x, y, 0) = t;
+		qualityMap(x, y, 1) = 1.0 - t;
+		qualityMap(x, y, 2) = 0.0; });
+
+	std::string qualityMapName = metadata.image_name;
+	if (qualityMapName.size() > 4 && qualityMapName.compare(qualityMapName.size() - 4, 4, ".png") == 0)
+	{
+		qualityMapName.erase(qualityMapName.size() - 4);
+	}
+	qualityMapName += "_quality.png";
+	qualityMap.savePng(qualityMapName);
+	std::cout << "Quality map written to " << qualityMapName << std::endl;
+}
+
+// The quality levels used to meet a time budget, from the full quality down to the fastest
+std::vector<QualityLevel> getQualityLevels(const RenderMetadata &metadata)
+{
+	std::vector<QualityLevel> levels;
+
+	QualitySettings settings;
+	if (metadata.enable_supersampling)
+	{
+		// Sample grouping shades each object once, so it costs a lot less than 9 full samples
+		levels.push_back({settings, metadata.enable_sample_grouping ? 3.0 : 9.0, "full quality"});
+		settings.allowSupersampling = false;
+		levels.push_back({settings, 1.0, "no supersampling"});
+	}
+	else
+	{
+		levels.push_back({settings, 1.0, "full quality"});
+	}
+
+	settings.emissionSampleScale = 0.25f;
+	levels.push_back({settings, 0.5, "1/4 of the area light samples"});
+
+	settings.emissionSampleScale = 0.1f;
+	settings.maxDepth = 1;
+	levels.push_back({settings, 0.3, "1/10 of the area light samples, one bounce"});
+
+	settings.emissionSampleScale = 0.0f;
+	settings.maxDepth = 0;
+	levels.push_back({settings, 0.2, "one area light sample, no bounces"});
+
+	return levels;
+}
+
+// Predict how long each tile (in the order of RenderingThreadPool::makeTiles) takes to render,
+// by timing a single sample for a sparse grid of its pixels
+std::vector<double> estimateTileCosts(const SceneBVH &scene, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights)
+{
+	std::vector<Tile> tiles = RenderingThreadPool::makeTiles(metadata.image_width, metadata.image_height);
+	std::vector<double> costs(tiles.size(), 0.0);
+
+	auto start = std::chrono::steady_clock::now();
+	ThreadPool::global().parallelFor(0, tiles.size(), [&](size_t t)
+									 {
+		const Tile &tile = tiles[t];
+		auto tileStart = std::chrono::steady_clock::now();
+		for (uint32_t y = tile.y0 + COST_PREDICTION_STRIDE / 2; y < tile.y1; y += COST_PREDICTION_STRIDE)
+		{
+			for (uint32_t x = tile.x0 + COST_PREDICTION_STRIDE / 2; x < tile.x1; x += COST_PREDICTION_STRIDE)
+			{
+				renderPixel(scene, glm::vec2(x, y), metadata, background_image, areaLights);
+			}
+		}
+		costs[t] = std::chrono::duration<double>(std::chrono::steady_clock::now() - tileStart).count(); });
+
+	std::cout << "Predicted the cost of " << tiles.size() << " tiles in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s" << std::endl;
+	return costs;
+}
+
+// Get a random offset within a pixel, used to place accumulated samples
+glm::vec2 getPixelJitter()
+{
+	static thread_local std::mt19937 generator(std::random_device{}());
+	std::uniform_real_distribution<float> distribution(-0.5f, 0.5f);
+	return glm::vec2(distribution(generator), distribution(generator));
 }
 
 // Helper method to get the color of a pixel. Potentially do supersampling
-glm::vec3 getPixelColor(SceneNode *root, uint x, uint y, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights)
+glm::vec3 getPixelColor(const SceneBVH &scene, uint x, uint y, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights, const QualitySettings &quality)
 {
 	glm::vec3 colour = glm::vec3(0.0f);
 
-	if (!metadata.enable_supersampling)
+	if (!metadata.enable_supersampling || !quality.allowSupersampling)
 	{
 		glm::vec2 pixel = glm::vec2(x, y);
-		colour = renderPixel(root, pixel, metadata, background_image, areaLights);
+		colour = renderPixel(scene, pixel, metadata, background_image, areaLights, quality);
+	}
+	else if (metadata.enable_sample_grouping)
+	{
+		colour = renderGroupedPixel(scene, x, y, metadata, background_image, areaLights, quality);
 	}
 	else
 	{
@@ -124,7 +796,7 @@ glm::vec3 getPixelColor(SceneNode *root, uint x, uint y, const RenderMetadata &m
 			for (double yOffset = -0.5; yOffset <= 0.5; yOffset += 0.5)
 			{
 				glm::vec2 pixel = glm::vec2(x + xOffset, y + yOffset);
-				colours[i++] = renderPixel(root, pixel, metadata, background_image, areaLights);
+				colours[i++] = renderPixel(scene, pixel, metadata, background_image, areaLights, quality);
 			}
 		}
 
@@ -139,13 +811,96 @@ glm::vec3 getPixelColor(SceneNode *root, uint x, uint y, const RenderMetadata &m
 	return colour;
 }
 
-glm::vec3 renderPixel(SceneNode *root, glm::vec2 pixel, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights)
+glm::vec3 renderPixel(const SceneBVH &scene, glm::vec2 pixel, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights, const QualitySettings &quality)
+{
+	std::function<glm::vec3(const Ray &)> backgroundFunction = getBackgroundFunction(metadata, background_image);
+
+	// Now trace the ray
+	Ray ray = getCameraRay(pixel, metadata);
+	return trace(scene, ray, metadata.scene_ambient, metadata.scene_lights, areaLights, backgroundFunction, 1.0f, quality);
+}
+
+// Supersample a pixel like an MSAA rasterizer would: visibility is resolved for every sub-sample,
+// but the (expensive) shading and shadow rays are only computed once for each object that was hit.
+glm::vec3 renderGroupedPixel(const SceneBVH &scene, uint x, uint y, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights, const QualitySettings &quality)
+{
+	struct SampleGroup
+	{
+		const GeometryNode *node;
+		glm::vec2 offset;
+		Ray ray;
+		Intersection intersection;
+		int count;
+	};
+
+	std::function<glm::vec3(const Ray &)> backgroundFunction = getBackgroundFunction(metadata, background_image);
+
+	glm::vec3 colour = glm::vec3(0.0f);
+	std::vector<SampleGroup> groups;
+	int sampleCount = 0;
+
+	for (double xOffset = -0.5; xOffset <= 0.5; xOffset += 0.5)
+	{
+		for (double yOffset = -0.5; yOffset <= 0.5; yOffset += 0.5)
+		{
+			sampleCount++;
+			glm::vec2 offset = glm::vec2(xOffset, yOffset);
+			Ray ray = getCameraRay(glm::vec2(x, y) + offset, metadata);
+			Intersection intersection = intersectWithScene(scene, ray);
+
+			// The background is cheap, so we can evaluate it for every sample
+			if (!intersection.isValid || ray.getT(intersection.entry.position) < 0)
+			{
+				colour += backgroundFunction(ray);
+				continue;
+			}
+
+			auto group = std::find_if(groups.begin(), groups.end(), [&intersection](const SampleGroup &g)
+									  { return g.node == intersection.entry.node && g.intersection.entry.objectId == intersection.entry.objectId &&
+												 g.intersection.entry.material == intersection.entry.material; });
+			if (group == groups.end())
+			{
+				groups.push_back({intersection.entry.node, offset, ray, intersection, 1});
+				continue;
+			}
+
+			// Shade each group with the sample closest to the center of the pixel
+			group->count++;
+			if (glm::length(offset) < glm::length(group->offset))
+			{
+				group->offset = offset;
+				group->ray = ray;
+				group->intersection = intersection;
+			}
+		}
+	}
+
+	for (SampleGroup &group : groups)
+	{
+		glm::vec3 groupColour = shade(scene, group.ray, group.intersection, metadata.scene_ambient, metadata.scene_lights, areaLights, backgroundFunction, 1.0f, quality);
+		colour += (float)group.count * groupColour;
+	}
+
+	return colour / (float)sampleCount;
+}
+
+// Get the primary ray that goes from the camera through the given (sub-)pixel
+Ray getCameraRay(const glm::vec2 &pixel, const RenderMetadata &metadata)
 {
 	// Get the position of the pixel in camera space
 	glm::vec3 pixelPosition = pixelToCameraPos(metadata.image_width, metadata.image_height, metadata.camera_eye, metadata.camera_view, metadata.camera_up, metadata.camera_fovy, pixel);
+	addTelemetry(CameraRays);
+
+	// The cone of the ray covers one pixel: the pixels span 2 tan(fovy / 2) vertically at a distance of 1
+	float pixelSpread = 2.0f * std::tan(glm::radians(metadata.camera_fovy) / 2.0f) / metadata.image_height;
+
+	return Ray(metadata.camera_eye, glm::normalize(pixelPosition - metadata.camera_eye), 0.0f, pixelSpread);
+}
 
-	// Define a function to get the background color
-	std::function<glm::vec3(const Ray &)> backgroundFunction = [&metadata, &background_image](const Ray &backgroundRay)
+// Define a function to get the background color of primary rays that do not hit anything
+std::function<glm::vec3(const Ray &)> getBackgroundFunction(const RenderMetadata &metadata, std::unique_ptr<Image> &background_image)
+{
+	return [&metadata, &background_image](const Ray &backgroundRay)
 	{
 		glm::vec2 pixel = rayToPixel(metadata.image_width, metadata.image_height, metadata.camera_eye, metadata.camera_view, metadata.camera_up, metadata.camera_fovy, backgroundRay);
 
@@ -165,10 +920,6 @@ glm::vec3 renderPixel(SceneNode *root, glm::vec2 pixel, const RenderMetadata &me
 		}
 		return getBackground(pixel, metadata.image_width, metadata.image_height);
 	};
-
-	// Now trace the ray
-	Ray ray(metadata.camera_eye, glm::normalize(pixelPosition - metadata.camera_eye));
-	return trace(root, ray, metadata.scene_ambient, metadata.scene_lights, areaLights, backgroundFunction, 1.0f);
 }
 
 // Provide a background color for the scene if no image is provided
@@ -1,18 +1,61 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <future>
+#include <functional>
+#include <set>
 
 #include "../Modeling/SceneNode.hpp"
 #include "../Modeling/Light.hpp"
 #include "Image.hpp"
 #include "../Modeling/Primitive.hpp"
 #include "../Lua/scene_lua.hpp"
+#include "RayTracer.hpp"
+
+// A step on the quality ladder that is used to meet a time budget
+struct QualityLevel
+{
+	QualitySettings settings;
+	// The expected cost of a pixel relative to a single full quality sample, used until the level has been timed
+	double expectedCost;
+	std::string description;
+};
 
 void Render(SceneNode *root, Image &image, const RenderMetadata &metadata);
 
-glm::vec3 getPixelColor(SceneNode *root, uint x, uint y, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights);
+void Animate(SceneNode *root, int frameStart, int frameEnd, const std::function<RenderMetadata(int)> &frameMetadata, const std::function<void(int)> &update);
+
+std::future<std::unique_ptr<Image>> loadBackgroundImage(const RenderMetadata &metadata);
+
+std::list<GeometryNode *> prepareScene(SceneNode *root, SceneBVH &scene);
+
+void checkPrototype(const SceneNode *node, bool hasMaterial, std::set<std::pair<const SceneNode *, bool>> &checked);
+
+void printRenderInfo(SceneNode *root, const Image &image, const RenderMetadata &metadata);
+
+void renderImage(const SceneBVH &scene, Image &image, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights);
+
+void renderProgressive(const SceneBVH &scene, Image &image, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights);
+
+void renderDenoised(const SceneBVH &scene, Image &image, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights);
+
+void renderWithDeadline(const SceneBVH &scene, Image &image, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights);
+
+std::vector<QualityLevel> getQualityLevels(const RenderMetadata &metadata);
+
+std::vector<double> estimateTileCosts(const SceneBVH &scene, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights);
+
+glm::vec2 getPixelJitter();
+
+glm::vec3 getPixelColor(const SceneBVH &scene, uint x, uint y, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights, const QualitySettings &quality = QualitySettings());
+
+glm::vec3 renderPixel(const SceneBVH &scene, glm::vec2 pixel, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights, const QualitySettings &quality = QualitySettings());
+
+glm::vec3 renderGroupedPixel(const SceneBVH &scene, uint x, uint y, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights, const QualitySettings &quality = QualitySettings());
+
+Ray getCameraRay(const glm::vec2 &pixel, const RenderMetadata &metadata);
 
-glm::vec3 renderPixel(SceneNode *root, glm::vec2 pixel, const RenderMetadata &metadata, std::unique_ptr<Image> &background_image, std::list<GeometryNode *> &areaLights);
+std::function<glm::vec3(const Ray &)> getBackgroundFunction(const RenderMetadata &metadata, std::unique_ptr<Image> &background_image);
 
 glm::vec3 getBackground(const glm::vec2 &pixel, size_t width, size_t height);
 
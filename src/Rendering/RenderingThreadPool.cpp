@@ -1,51 +1,184 @@
 #include <iostream>
+#include <algorithm>
 
 #include "RenderingThreadPool.hpp"
 
+// How often the progress is printed while rendering, in seconds
+const double PROGRESS_INTERVAL = 1.0;
+
+// Tiles that are predicted to cost more than this many times the average tile are split
+const double HOT_TILE_FACTOR = 2.0;
+
+// Interleave the bits of x and y, so that sorting by the result gives a Z-order (Morton) curve
+static uint32_t mortonCode(uint32_t x, uint32_t y)
+{
+    uint32_t code = 0;
+    for (uint32_t bit = 0; bit < 16; ++bit)
+    {
+        code |= ((x >> bit) & 1) << (2 * bit);
+        code |= ((y >> bit) & 1) << (2 * bit + 1);
+    }
+    return code;
+}
+
 RenderingThreadPool::RenderingThreadPool(size_t num_threads, size_t width_, size_t height_)
     : width(width_), height(height_)
 {
-    threads.reserve(num_threads);
+    num_threads = std::max<size_t>(num_threads, 1);
+
+    std::vector<Tile> tiles = makeTiles(width, height);
+    tile_count = tiles.size();
+
+    // Give every thread a contiguous (and therefore spatially coherent) range of the tiles
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        queues.push_back(std::make_unique<TileQueue>());
+        size_t begin = i * tile_count / num_threads;
+        size_t end = (i + 1) * tile_count / num_threads;
+        for (size_t t = begin; t < end; ++t)
+        {
+            queues[i]->tiles.push_back(tiles[t]);
+        }
+    }
+}
+
+RenderingThreadPool::RenderingThreadPool(size_t num_threads, size_t width_, size_t height_, const std::vector<double> &tile_costs)
+    : width(width_), height(height_)
+{
+    num_threads = std::max<size_t>(num_threads, 1);
+
+    std::vector<Tile> tiles = makeTiles(width, height);
+    double total_cost = 0.0;
+    for (double cost : tile_costs)
+    {
+        total_cost += cost;
+    }
+    double hot_cost = HOT_TILE_FACTOR * total_cost / std::max<size_t>(tiles.size(), 1);
+
+    // Split the hot tiles into quarters, which are assumed to cost a quarter each
+    std::vector<std::pair<double, Tile>> costed_tiles;
+    for (size_t t = 0; t < tiles.size(); ++t)
+    {
+        const Tile &tile = tiles[t];
+        if (tile_costs[t] <= hot_cost || tile.x1 - tile.x0 < 2 || tile.y1 - tile.y0 < 2)
+        {
+            costed_tiles.push_back(std::make_pair(tile_costs[t], tile));
+            continue;
+        }
+
+        uint32_t x_mid = (tile.x0 + tile.x1) / 2;
+        uint32_t y_mid = (tile.y0 + tile.y1) / 2;
+        costed_tiles.push_back(std::make_pair(tile_costs[t] / 4, Tile{tile.x0, tile.y0, x_mid, y_mid}));
+        costed_tiles.push_back(std::make_pair(tile_costs[t] / 4, Tile{x_mid, tile.y0, tile.x1, y_mid}));
+        costed_tiles.push_back(std::make_pair(tile_costs[t] / 4, Tile{tile.x0, y_mid, x_mid, tile.y1}));
+        costed_tiles.push_back(std::make_pair(tile_costs[t] / 4, Tile{x_mid, y_mid, tile.x1, tile.y1}));
+    }
+    std::stable_sort(costed_tiles.begin(), costed_tiles.end(), [](const std::pair<double, Tile> &a, const std::pair<double, Tile> &b)
+                     { return a.first > b.first; });
+    tile_count = costed_tiles.size();
+
+    // Every queue goes from expensive to cheap, so thieves take the cheap tiles from the back
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        queues.push_back(std::make_unique<TileQueue>());
+    }
+    for (size_t t = 0; t < tile_count; ++t)
+    {
+        queues[t % num_threads]->tiles.push_back(costed_tiles[t].second);
+    }
+}
+
+std::vector<Tile> RenderingThreadPool::makeTiles(size_t width, size_t height)
+{
+    std::vector<std::pair<uint32_t, Tile>> tiles;
+    for (uint32_t tileY = 0; tileY * TILE_SIZE < height; ++tileY)
+    {
+        for (uint32_t tileX = 0; tileX * TILE_SIZE < width; ++tileX)
+        {
+            Tile tile;
+            tile.x0 = tileX * TILE_SIZE;
+            tile.y0 = tileY * TILE_SIZE;
+            tile.x1 = std::min<uint32_t>(tile.x0 + TILE_SIZE, width);
+            tile.y1 = std::min<uint32_t>(tile.y0 + TILE_SIZE, height);
+            tiles.push_back(std::make_pair(mortonCode(tileX, tileY), tile));
+        }
+    }
+    std::sort(tiles.begin(), tiles.end(), [](const std::pair<uint32_t, Tile> &a, const std::pair<uint32_t, Tile> &b)
+              { return a.first < b.first; });
+
+    std::vector<Tile> result;
+    for (const std::pair<uint32_t, Tile> &tile : tiles)
+    {
+        result.push_back(tile.second);
+    }
+    return result;
 }
 
-void RenderingThreadPool::process(std::function<void(uint32_t, uint32_t)> func)
+void RenderingThreadPool::process(std::function<void(const Tile &)> func, bool report_progress)
 {
-    pixel_function = std::move(func);
+    tile_function = std::move(func);
+    if (report_progress)
+    {
+        reporter = std::make_unique<TelemetryReporter>(width * height, PROGRESS_INTERVAL);
+    }
 
-    for (size_t i = 0; i < threads.capacity(); ++i)
+    for (size_t i = 0; i < queues.size(); ++i)
     {
-        threads.emplace_back([this]()
-                             {
-            while (true)
+        workers.run([this, i]()
+                    {
+            Tile tile;
+            while (popTile(i, tile) || stealTile(i, tile))
             {
-                // Get next row atomically
-                size_t y = current_row.fetch_add(1);
-                
-                // Exit if no more rows
-                if (y >= height) {
-                    break;
-                }
-
-                if (y % (height / 10) == 0)
-                {
-                    std::cout << "Progress: " << (y / (height / 10)) * 10 << "%" << " for y = " << y << std::endl;
-                }
-                
-                // Process entire row
-                for (uint32_t x = 0; x < width; ++x) {
-                    pixel_function(x, y);
-                }
+                tile_function(tile);
+                addTelemetry(PixelsDone, (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
             } });
     }
 }
 
-RenderingThreadPool::~RenderingThreadPool()
+// Take the next tile from the front of this thread's own range
+bool RenderingThreadPool::popTile(size_t thread_index, Tile &tile)
+{
+    TileQueue &queue = *queues[thread_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tiles.empty())
+    {
+        return false;
+    }
+
+    tile = queue.tiles.front();
+    queue.tiles.pop_front();
+    return true;
+}
+
+// Take a tile from the back of another thread's range. This keeps the two threads working far apart.
+bool RenderingThreadPool::stealTile(size_t thread_index, Tile &tile)
 {
-    for (auto &thread : threads)
+    for (size_t offset = 1; offset < queues.size(); ++offset)
     {
-        if (thread.joinable())
+        TileQueue &queue = *queues[(thread_index + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tiles.empty())
         {
-            thread.join();
+            tile = queue.tiles.back();
+            queue.tiles.pop_back();
+            return true;
         }
     }
+
+    return false;
+}
+
+void RenderingThreadPool::join()
+{
+    // If a tile threw, the reporter is stopped when the pool is destroyed instead
+    workers.wait();
+    if (reporter)
+    {
+        reporter->stop();
+    }
+}
+
+RenderingThreadPool::~RenderingThreadPool()
+{
+    // The task group waits for any workers that are still running, before the reporter prints its summary
 }
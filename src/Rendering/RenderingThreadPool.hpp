@@ -1,22 +1,83 @@
+#pragma once
+
 #include <vector>
-#include <thread>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <atomic>
 #include <functional>
 
+#include "ThreadPool.hpp"
+#include "Telemetry.hpp"
+
+// The width and height of a tile, in pixels
+const uint32_t TILE_SIZE = 16;
+
+// A rectangle of pixels from [x0, x1) x [y0, y1)
+struct Tile
+{
+    uint32_t x0;
+    uint32_t y0;
+    uint32_t x1;
+    uint32_t y1;
+};
+
+// Call the function for every pixel in the tile. This is a template so that the per-pixel work is inlined.
+template <typename PixelFunction>
+void forEachPixel(const Tile &tile, PixelFunction &&pixelFunction)
+{
+    for (uint32_t y = tile.y0; y < tile.y1; ++y)
+    {
+        for (uint32_t x = tile.x0; x < tile.x1; ++x)
+        {
+            pixelFunction(x, y);
+        }
+    }
+}
+
+// Renders an image in tiles on the global ThreadPool. The tiles are ordered along a Morton curve and
+// split into one contiguous range per worker. Workers go through their own range front to back, and
+// steal from the back of another worker's range when they run out of work.
+// If the cost of every tile is known up front, the tiles are instead handed out most expensive first.
 class RenderingThreadPool
 {
 private:
-    std::vector<std::thread> threads;
-    std::atomic<size_t> current_row{0};
+    struct TileQueue
+    {
+        std::mutex mutex;
+        std::deque<Tile> tiles;
+    };
+
+    std::vector<std::unique_ptr<TileQueue>> queues;
+    size_t tile_count;
     const size_t width;
     const size_t height;
-    std::function<void(uint, uint)> pixel_function;
+    std::function<void(const Tile &)> tile_function;
+    std::unique_ptr<TelemetryReporter> reporter;
+
+    // Declared last, so that it waits for the workers before anything else is destroyed
+    TaskGroup workers;
+
+    bool popTile(size_t thread_index, Tile &tile);
+    bool stealTile(size_t thread_index, Tile &tile);
 
 public:
     RenderingThreadPool(size_t num_threads, size_t width_, size_t height_);
 
-    void process(std::function<void(uint32_t, uint32_t)> func);
+    // Order the tiles by decreasing cost (longest processing time first), and deal them out to the
+    // workers in turn. Tiles that cost a lot more than average are split into four smaller tiles.
+    // The costs are given for the tiles in the order of makeTiles().
+    RenderingThreadPool(size_t num_threads, size_t width_, size_t height_, const std::vector<double> &tile_costs);
+
+    // Split an image into tiles, in Morton order
+    static std::vector<Tile> makeTiles(size_t width, size_t height);
+
+    // Process every tile. Unless report_progress is false, the progress is printed while rendering.
+    void process(std::function<void(const Tile &)> func, bool report_progress = true);
+
+    // Wait for all tiles to be processed, and print a summary of the telemetry.
+    // Rethrows any exception thrown while rendering a tile.
+    void join();
 
     ~RenderingThreadPool();
-};
\ No newline at end of file
+};
@@ -0,0 +1,745 @@
+#include <iostream>
+#include <algorithm>
+#include <typeinfo>
+
+#include "SceneBVH.hpp"
+#include "RayTracer.hpp"
+#include "../Modeling/GeometryNode.hpp"
+#include "../Modeling/BooleanNode.hpp"
+#include "../Modeling/InstanceNode.hpp"
+#include "../Modeling/Primitive.hpp"
+
+// Leaves hold at most this many objects, unless the objects cannot be split any further
+const uint32_t MAX_LEAF_OBJECTS = 4;
+
+// The number of buckets the objects are sorted into along an axis to find the best split
+const int SAH_BIN_COUNT = 12;
+
+// Below this depth, the objects are split in half instead. This bounds the depth of the tree (and the traversal stack).
+const int MAX_SAH_DEPTH = 32;
+const int TRAVERSAL_STACK_SIZE = 128;
+
+// The cost of visiting a node compared to intersecting an object, for the surface area heuristic
+const float TRAVERSAL_COST = 1.0f;
+const float OBJECT_COST = 4.0f;
+
+// Auto instancing only turns subtrees of at least this many objects into instances. Instancing a single object
+// would save nothing, since every instance is an object of its own in the tree.
+const uint32_t MIN_AUTO_INSTANCE_OBJECTS = 2;
+
+// The tree is rebuilt once refitting has made its SAH cost this many times higher than when it was built
+const float REBUILD_COST_RATIO = 1.5f;
+
+// How far (relative to the scale) the terms of a transform may be from those of a pure translation and scale for it
+// to still be baked into a primitive. Rotations by multiples of 90 degrees leave terms this small behind.
+const float BAKE_TOLERANCE = 1e-6f;
+
+SceneBVH::SceneBVH()
+    : prototypes(&ownPrototypes)
+{
+}
+
+SceneBVH::SceneBVH(PrototypeMap *prototypes, bool includeRootTransform)
+    : includeRootTransform(includeRootTransform), prototypes(prototypes)
+{
+}
+
+void SceneBVH::setAutoInstancing(bool enabled)
+{
+    if (autoInstancing != enabled)
+    {
+        autoInstancing = enabled;
+        built = false;
+    }
+}
+
+void SceneBVH::update(SceneNode *root)
+{
+    if (built && generation == SceneNode::transformGeneration())
+    {
+        return;
+    }
+    generation = SceneNode::transformGeneration();
+
+    // Only the scene itself reports what it does, and not the tree of every prototype
+    bool isScene = prototypes == &ownPrototypes;
+
+    std::unique_ptr<DuplicateSearch> search;
+    if (autoInstancing)
+    {
+        search.reset(new DuplicateSearch());
+        countSubtrees(root, *search);
+    }
+
+    std::vector<ObjectSource> sources;
+    collectObjects(root, includeRootTransform ? root->trans : glm::mat4(1.0f), sources, search.get());
+
+    bool sameObjects = built && sources.size() == objectKeys.size();
+    for (size_t i = 0; sameObjects && i < sources.size(); ++i)
+    {
+        sameObjects = sources[i].node == objectKeys[i].first && sources[i].prototype == objectKeys[i].second;
+    }
+
+    if (!sameObjects)
+    {
+        build(sources);
+        if (isScene)
+        {
+            std::cout << "Built the scene BVH over " << objects.size() << " objects";
+            if (!prototypes->empty())
+            {
+                std::cout << " and " << prototypes->size() << " instance prototypes";
+            }
+            std::cout << std::endl;
+        }
+        return;
+    }
+
+    // Only transforms changed, so the tree still fits the scene after its bounds are updated
+    refit(sources);
+    float refitCost = cost();
+    if (refitCost > REBUILD_COST_RATIO * builtCost)
+    {
+        if (isScene)
+        {
+            std::cout << "Rebuilt the scene BVH, since refitting made it " << refitCost / builtCost << " times as expensive" << std::endl;
+        }
+        build(sources);
+    }
+}
+
+Intersection SceneBVH::intersect(const Ray &ray) const
+{
+    Intersection closest;
+    float closestT = std::numeric_limits<float>::infinity();
+    if (nodes.empty())
+    {
+        return closest;
+    }
+
+    // Ray::getT scales with the length of the direction, while the boxes use the ray parameter
+    float directionLength2 = glm::dot(ray.direction, ray.direction);
+    glm::vec3 inverseDirection = 1.0f / ray.direction;
+
+    uint32_t stack[TRAVERSAL_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        uint32_t index = stack[--stackSize];
+        const Node &node = nodes[index];
+
+        float tEntry;
+        if (!node.bounds.intersect(ray.start, inverseDirection, closestT / directionLength2, tEntry))
+        {
+            continue;
+        }
+
+        if (node.objectCount > 0)
+        {
+            for (uint32_t i = 0; i < node.objectCount; ++i)
+            {
+                intersectObject(objects[node.index + i], ray, closest, closestT);
+            }
+            continue;
+        }
+
+        // Visit the child on the near side of the split first, so that hits there can cull the other child
+        uint32_t nearChild = index + 1;
+        uint32_t farChild = node.index;
+        if (ray.direction[node.axis] < 0)
+        {
+            std::swap(nearChild, farChild);
+        }
+        stack[stackSize++] = farChild;
+        stack[stackSize++] = nearChild;
+    }
+
+    return closest;
+}
+
+size_t SceneBVH::objectCount() const
+{
+    return objects.size();
+}
+
+static void hashCombine(size_t &seed, size_t value)
+{
+    seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+static void hashCombine(size_t &seed, const glm::vec3 &value)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        hashCombine(seed, std::hash<float>()(value[i]));
+    }
+}
+
+// Hash what a subtree looks like in the space of its root: the types and shapes of its nodes, their materials,
+// and the transforms of everything below the root. Duplicates hash the same wherever they are in the scene.
+const SceneBVH::DuplicateSearch::Subtree &SceneBVH::hashSubtree(const SceneNode *node, DuplicateSearch &search)
+{
+    auto found = search.subtrees.find(node);
+    if (found != search.subtrees.end())
+    {
+        return found->second;
+    }
+
+    DuplicateSearch::Subtree subtree;
+    subtree.hash = std::hash<int>()((int)node->m_nodeType);
+    subtree.objectCount = node->m_nodeType == NodeType::SceneNode ? 0 : 1;
+    subtree.instanceable = true;
+
+    if (node->m_nodeType == NodeType::GeometryNode)
+    {
+        const GeometryNode *geometryNode = static_cast<const GeometryNode *>(node);
+        AABB bounds = geometryNode->m_primitive->getBounds();
+        hashCombine(subtree.hash, typeid(*geometryNode->m_primitive).hash_code());
+        hashCombine(subtree.hash, bounds.min);
+        hashCombine(subtree.hash, bounds.max);
+        hashCombine(subtree.hash, std::hash<const void *>()(geometryNode->m_material));
+        hashCombine(subtree.hash, std::hash<const void *>()(geometryNode->m_texture));
+        hashCombine(subtree.hash, std::hash<const void *>()(geometryNode->m_normal));
+        subtree.instanceable = geometryNode->m_emission == nullptr;
+    }
+    else if (node->m_nodeType == NodeType::BooleanNode)
+    {
+        hashCombine(subtree.hash, std::hash<int>()((int)static_cast<const BooleanNode *>(node)->m_type));
+    }
+    else if (node->m_nodeType == NodeType::InstanceNode)
+    {
+        const InstanceNode *instanceNode = static_cast<const InstanceNode *>(node);
+        hashCombine(subtree.hash, std::hash<const void *>()(instanceNode->m_prototype));
+        hashCombine(subtree.hash, std::hash<const void *>()(instanceNode->m_material));
+    }
+
+    for (const SceneNode *child : node->children)
+    {
+        const DuplicateSearch::Subtree &childSubtree = hashSubtree(child, search);
+        hashCombine(subtree.hash, childSubtree.hash);
+        for (int column = 0; column < 4; ++column)
+        {
+            hashCombine(subtree.hash, glm::vec3(child->trans[column]));
+        }
+
+        // The CSG tree below a BooleanNode is part of its one object
+        if (node->m_nodeType != NodeType::BooleanNode)
+        {
+            subtree.objectCount += childSubtree.objectCount;
+        }
+        subtree.instanceable = subtree.instanceable && childSubtree.instanceable;
+    }
+
+    return search.subtrees[node] = subtree;
+}
+
+// Count how often each kind of subtree occurs in the scene
+void SceneBVH::countSubtrees(const SceneNode *node, DuplicateSearch &search)
+{
+    search.counts[hashSubtree(node, search).hash]++;
+    for (const SceneNode *child : node->children)
+    {
+        countSubtrees(child, search);
+    }
+}
+
+// Check that two subtrees with the same hash really are the same, apart from the transforms of their roots
+bool SceneBVH::sameSubtree(const SceneNode *a, const SceneNode *b)
+{
+    if (a == b)
+    {
+        return true;
+    }
+
+    if (a->m_nodeType != b->m_nodeType || a->children.size() != b->children.size())
+    {
+        return false;
+    }
+
+    if (a->m_nodeType == NodeType::GeometryNode)
+    {
+        const GeometryNode *geometryA = static_cast<const GeometryNode *>(a);
+        const GeometryNode *geometryB = static_cast<const GeometryNode *>(b);
+        if (geometryA->m_material != geometryB->m_material || geometryA->m_texture != geometryB->m_texture ||
+            geometryA->m_normal != geometryB->m_normal || geometryA->m_emission != geometryB->m_emission ||
+            !geometryA->m_primitive->sameShape(geometryB->m_primitive))
+        {
+            return false;
+        }
+    }
+    else if (a->m_nodeType == NodeType::BooleanNode)
+    {
+        if (static_cast<const BooleanNode *>(a)->m_type != static_cast<const BooleanNode *>(b)->m_type)
+        {
+            return false;
+        }
+    }
+    else if (a->m_nodeType == NodeType::InstanceNode)
+    {
+        const InstanceNode *instanceA = static_cast<const InstanceNode *>(a);
+        const InstanceNode *instanceB = static_cast<const InstanceNode *>(b);
+        if (instanceA->m_prototype != instanceB->m_prototype || instanceA->m_material != instanceB->m_material)
+        {
+            return false;
+        }
+    }
+
+    auto childB = b->children.begin();
+    for (const SceneNode *childA : a->children)
+    {
+        if (childA->trans != (*childB)->trans || !sameSubtree(childA, *childB))
+        {
+            return false;
+        }
+        ++childB;
+    }
+    return true;
+}
+
+// The objects are the GeometryNodes, BooleanNodes and InstanceNodes, apart from those that are part of a CSG tree.
+// This also brings the tree of the prototype of every instance up to date.
+void SceneBVH::collectObjects(const SceneNode *node, const glm::mat4 &transform, std::vector<ObjectSource> &sources, DuplicateSearch *search)
+{
+    // Subtrees of more than one object that occur more than once become instances of the first of them
+    if (search != nullptr)
+    {
+        const DuplicateSearch::Subtree &subtree = search->subtrees.at(node);
+        if (subtree.instanceable && subtree.objectCount >= MIN_AUTO_INSTANCE_OBJECTS && search->counts[subtree.hash] >= 2)
+        {
+            std::vector<const SceneNode *> &representatives = search->representatives[subtree.hash];
+            auto representative = std::find_if(representatives.begin(), representatives.end(), [node](const SceneNode *other)
+                                               { return sameSubtree(other, node); });
+            if (representative == representatives.end())
+            {
+                representatives.push_back(node);
+                representative = representatives.end() - 1;
+            }
+
+            sources.push_back({node, transform, prototypeBVH(*representative, false), false});
+            return;
+        }
+    }
+
+    if (node->m_nodeType == NodeType::BooleanNode)
+    {
+        sources.push_back({node, transform, nullptr, false});
+        return;
+    }
+
+    if (node->m_nodeType == NodeType::InstanceNode)
+    {
+        sources.push_back({node, transform, prototypeBVH(static_cast<const InstanceNode *>(node)->m_prototype, true), true});
+    }
+    else if (node->m_nodeType == NodeType::GeometryNode)
+    {
+        sources.push_back({node, transform, nullptr, false});
+    }
+
+    for (const SceneNode *child : node->children)
+    {
+        collectObjects(child, transform * child->trans, sources, search);
+    }
+}
+
+// Get the tree of a prototype, which is shared by every instance of it, and bring it up to date
+SceneBVH *SceneBVH::prototypeBVH(const SceneNode *root, bool includeRootTransform)
+{
+    std::unique_ptr<SceneBVH> &prototype = (*prototypes)[std::make_pair(root, includeRootTransform)];
+    if (!prototype)
+    {
+        prototype.reset(new SceneBVH(prototypes, includeRootTransform));
+    }
+    prototype->update(const_cast<SceneNode *>(root));
+    return prototype.get();
+}
+
+// The bounds of everything that a node (and its children) can be hit at, in the space of its parent
+AABB SceneBVH::subtreeBounds(const SceneNode *node, const glm::mat4 &parentTransform)
+{
+    glm::mat4 transform = parentTransform * node->trans;
+    AABB bounds;
+    if (node->m_nodeType == NodeType::BooleanNode && node->children.size() == 2)
+    {
+        const BooleanNode *booleanNode = static_cast<const BooleanNode *>(node);
+        AABB first = subtreeBounds(node->children.front(), transform);
+        AABB second = subtreeBounds(node->children.back(), transform);
+        if (booleanNode->m_type == BooleanType::Difference)
+        {
+            return first;
+        }
+        if (booleanNode->m_type == BooleanType::Intersection)
+        {
+            return AABB(glm::max(first.min, second.min), glm::min(first.max, second.max));
+        }
+        first.extend(second);
+        return first;
+    }
+
+    if (node->m_nodeType == NodeType::GeometryNode)
+    {
+        const GeometryNode *geometryNode = static_cast<const GeometryNode *>(node);
+        bounds = geometryNode->m_primitive->getBounds().transformed(transform);
+    }
+    else if (node->m_nodeType == NodeType::InstanceNode)
+    {
+        bounds = subtreeBounds(static_cast<const InstanceNode *>(node)->m_prototype, transform);
+    }
+
+    for (const SceneNode *child : node->children)
+    {
+        bounds.extend(subtreeBounds(child, transform));
+    }
+    return bounds;
+}
+
+void SceneBVH::setObject(Object &object, const ObjectSource &source)
+{
+    const SceneNode *node = source.node;
+    object.node = node;
+    object.prototype = source.prototype;
+    object.instance = source.overridesMaterial ? static_cast<const InstanceNode *>(node) : nullptr;
+    object.localToWorld = source.transform;
+    object.worldToLocal = glm::inverse(object.localToWorld);
+    object.normalToWorld = glm::transpose(glm::inverse(glm::mat3(object.localToWorld)));
+
+    // The children of GeometryNodes and InstanceNodes are objects of their own
+    if (object.prototype != nullptr)
+    {
+        object.bounds = object.prototype->nodes.empty() ? AABB() : object.prototype->nodes[0].bounds.transformed(object.localToWorld);
+    }
+    else if (node->m_nodeType == NodeType::GeometryNode)
+    {
+        const GeometryNode *geometryNode = static_cast<const GeometryNode *>(node);
+        object.bounds = geometryNode->m_primitive->getBounds().transformed(object.localToWorld);
+    }
+    else
+    {
+        object.bounds = subtreeBounds(node, object.localToWorld * node->invtrans);
+    }
+
+    // Pad the bounds a little, so that rounding in the transforms never makes a ray miss the box of an object it hits
+    if (!object.bounds.isEmpty())
+    {
+        glm::vec3 padding = 1e-4f * (object.bounds.max - object.bounds.min + glm::abs(object.bounds.center())) + glm::vec3(1e-6f);
+        object.bounds.min -= padding;
+        object.bounds.max += padding;
+    }
+
+    bakeObject(object);
+}
+
+// Find the scale of a transform that only translates and scales, with a positive scale on every axis
+static bool getTranslateScale(const glm::mat4 &transform, glm::vec3 &scale)
+{
+    scale = glm::vec3(transform[0][0], transform[1][1], transform[2][2]);
+    if (scale.x <= 0.0f || scale.y <= 0.0f || scale.z <= 0.0f)
+    {
+        return false;
+    }
+
+    float tolerance = BAKE_TOLERANCE * glm::max(glm::max(scale.x, scale.y), scale.z);
+    for (int column = 0; column < 3; ++column)
+    {
+        for (int row = 0; row < 3; ++row)
+        {
+            if (row != column && std::abs(transform[column][row]) > tolerance)
+            {
+                return false;
+            }
+        }
+    }
+
+    return transform[0][3] == 0.0f && transform[1][3] == 0.0f && transform[2][3] == 0.0f && transform[3][3] == 1.0f;
+}
+
+static bool nearlyEqual(float a, float b)
+{
+    return std::abs(a - b) <= BAKE_TOLERANCE * glm::max(a, b);
+}
+
+// Bake the transform of an object into its primitive, if the world space form of the primitive can absorb it
+void SceneBVH::bakeObject(Object &object)
+{
+    object.bakedShape = BakedShape::None;
+
+    glm::vec3 scale;
+    if (object.prototype != nullptr || object.node->m_nodeType != NodeType::GeometryNode || !getTranslateScale(object.localToWorld, scale))
+    {
+        return;
+    }
+
+    const Primitive *primitive = static_cast<const GeometryNode *>(object.node)->m_primitive;
+    object.bakedPosition = glm::vec3(object.localToWorld[3]);
+    object.bakedSize = scale;
+    if (typeid(*primitive) == typeid(Sphere) && nearlyEqual(scale.x, scale.y) && nearlyEqual(scale.x, scale.z))
+    {
+        object.bakedShape = BakedShape::Sphere;
+    }
+    else if (typeid(*primitive) == typeid(Cube))
+    {
+        object.bakedShape = BakedShape::Box;
+    }
+    else if (typeid(*primitive) == typeid(Cylinder) && nearlyEqual(scale.x, scale.z))
+    {
+        object.bakedShape = BakedShape::Cylinder;
+    }
+}
+
+void SceneBVH::build(const std::vector<ObjectSource> &sources)
+{
+    objects.resize(sources.size());
+    objectKeys.resize(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        setObject(objects[i], sources[i]);
+        objects[i].sourceIndex = i;
+        objectKeys[i] = std::make_pair(sources[i].node, sources[i].prototype);
+    }
+
+    nodes.clear();
+    nodes.reserve(2 * objects.size());
+    if (!objects.empty())
+    {
+        buildNode(0, objects.size(), 0);
+    }
+
+    built = true;
+    builtCost = cost();
+}
+
+// Build the subtree over objects [begin, end) with a binned surface area heuristic, and return the index of its root
+uint32_t SceneBVH::buildNode(uint32_t begin, uint32_t end, int depth)
+{
+    uint32_t index = nodes.size();
+    nodes.push_back(Node());
+
+    AABB bounds;
+    AABB centerBounds;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        bounds.extend(objects[i].bounds);
+        centerBounds.extend(objects[i].bounds.center());
+    }
+    nodes[index].bounds = bounds;
+
+    uint32_t count = end - begin;
+    glm::vec3 centerExtent = centerBounds.max - centerBounds.min;
+    int axis = centerExtent.x > centerExtent.y ? (centerExtent.x > centerExtent.z ? 0 : 2) : (centerExtent.y > centerExtent.z ? 1 : 2);
+
+    auto makeLeaf = [&]()
+    {
+        nodes[index].index = begin;
+        nodes[index].objectCount = count;
+        nodes[index].axis = 0;
+        return index;
+    };
+
+    if (count == 1 || (count <= MAX_LEAF_OBJECTS && centerExtent[axis] <= 0.0f))
+    {
+        return makeLeaf();
+    }
+
+    uint32_t middle = begin + count / 2;
+    if (depth < MAX_SAH_DEPTH && centerExtent[axis] > 0.0f)
+    {
+        // Sort the objects into bins by their center, and try splitting between every pair of bins
+        AABB binBounds[SAH_BIN_COUNT];
+        uint32_t binCounts[SAH_BIN_COUNT] = {};
+        auto binOf = [&](const Object &object)
+        {
+            int bin = (int)(SAH_BIN_COUNT * (object.bounds.center()[axis] - centerBounds.min[axis]) / centerExtent[axis]);
+            return glm::clamp(bin, 0, SAH_BIN_COUNT - 1);
+        };
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            int bin = binOf(objects[i]);
+            binBounds[bin].extend(objects[i].bounds);
+            binCounts[bin]++;
+        }
+
+        float bestCost = std::numeric_limits<float>::infinity();
+        int bestSplit = 1;
+        for (int split = 1; split < SAH_BIN_COUNT; ++split)
+        {
+            AABB left, right;
+            uint32_t leftCount = 0, rightCount = 0;
+            for (int bin = 0; bin < split; ++bin)
+            {
+                left.extend(binBounds[bin]);
+                leftCount += binCounts[bin];
+            }
+            for (int bin = split; bin < SAH_BIN_COUNT; ++bin)
+            {
+                right.extend(binBounds[bin]);
+                rightCount += binCounts[bin];
+            }
+
+            float splitCost = TRAVERSAL_COST + OBJECT_COST * (left.surfaceArea() * leftCount + right.surfaceArea() * rightCount) / bounds.surfaceArea();
+            if (leftCount > 0 && rightCount > 0 && splitCost < bestCost)
+            {
+                bestCost = splitCost;
+                bestSplit = split;
+            }
+        }
+
+        if (count <= MAX_LEAF_OBJECTS && bestCost >= OBJECT_COST * count)
+        {
+            return makeLeaf();
+        }
+
+        Object *split = std::partition(objects.data() + begin, objects.data() + end, [&](const Object &object)
+                                       { return binOf(object) < bestSplit; });
+        middle = split - objects.data();
+    }
+
+    // Fall back to splitting the objects in half by their centers
+    if (middle == begin || middle == end || depth >= MAX_SAH_DEPTH || centerExtent[axis] <= 0.0f)
+    {
+        middle = begin + count / 2;
+        std::nth_element(objects.begin() + begin, objects.begin() + middle, objects.begin() + end, [axis](const Object &a, const Object &b)
+                         { return a.bounds.center()[axis] < b.bounds.center()[axis]; });
+    }
+
+    buildNode(begin, middle, depth + 1);
+    uint32_t right = buildNode(middle, end, depth + 1);
+    nodes[index].index = right;
+    nodes[index].objectCount = 0;
+    nodes[index].axis = axis;
+    return index;
+}
+
+// Recompute the bounds of every object, and then of every node. Children always come after their
+// parent in the node array, so going through it backwards updates the children first.
+void SceneBVH::refit(const std::vector<ObjectSource> &sources)
+{
+    for (Object &object : objects)
+    {
+        setObject(object, sources[object.sourceIndex]);
+    }
+
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        Node &node = nodes[i];
+        AABB bounds;
+        if (node.objectCount > 0)
+        {
+            for (uint32_t o = 0; o < node.objectCount; ++o)
+            {
+                bounds.extend(objects[node.index + o].bounds);
+            }
+        }
+        else
+        {
+            bounds = nodes[i + 1].bounds;
+            bounds.extend(nodes[node.index].bounds);
+        }
+        node.bounds = bounds;
+    }
+}
+
+// The SAH cost of the tree: the expected cost of tracing a ray, relative to intersecting one object
+float SceneBVH::cost() const
+{
+    if (nodes.empty() || nodes[0].bounds.surfaceArea() <= 0.0f)
+    {
+        return 0.0f;
+    }
+
+    float total = 0.0f;
+    for (const Node &node : nodes)
+    {
+        total += node.bounds.surfaceArea() * (node.objectCount > 0 ? OBJECT_COST * node.objectCount : TRAVERSAL_COST);
+    }
+    return total / nodes[0].bounds.surfaceArea();
+}
+
+void SceneBVH::intersectObject(const Object &object, const Ray &ray, Intersection &closest, float &closestT) const
+{
+    if (object.bakedShape != BakedShape::None)
+    {
+        Intersection intersection = intersectBakedObject(object, ray);
+        float t = ray.getT(intersection.entry.position);
+        if (intersection.isValid && (!closest.isValid || t < closestT))
+        {
+            closest = intersection;
+            closest.entry.objectId = object.sourceIndex;
+            closest.exit.objectId = object.sourceIndex;
+            closestT = t;
+        }
+        return;
+    }
+
+    // Transform the ray into the local space of the object
+    glm::vec3 rayStart = glm::vec3(object.worldToLocal * glm::vec4(ray.start, 1.0f));
+    glm::vec3 rayPoint = glm::vec3(object.worldToLocal * glm::vec4(ray.start + ray.direction, 1.0f));
+    Ray transformedRay(rayStart, glm::normalize(rayPoint - rayStart));
+
+    std::vector<Intersection> intersections;
+    if (object.prototype != nullptr)
+    {
+        Intersection intersection = object.prototype->intersect(transformedRay);
+        if (intersection.isValid)
+        {
+            if (object.instance != nullptr)
+            {
+                applyMaterialOverride(intersection, object.instance->m_material);
+            }
+            intersections.push_back(intersection);
+        }
+    }
+    else
+    {
+        intersections = computeLeafIntersection(object.node, transformedRay);
+    }
+    for (Intersection &intersection : intersections)
+    {
+        transformIntersection(intersection, object.localToWorld, object.normalToWorld);
+
+        float t = ray.getT(intersection.entry.position);
+        if (!closest.isValid || t < closestT)
+        {
+            // The prototype's own object id is replaced by the one of this instance
+            closest = intersection;
+            closest.entry.objectId = object.sourceIndex;
+            closest.exit.objectId = object.sourceIndex;
+            closestT = t;
+        }
+    }
+}
+
+// Intersect with a baked primitive in world space, the way computeLeafIntersection does with the primitive in its local space
+Intersection SceneBVH::intersectBakedObject(const Object &object, const Ray &ray)
+{
+    Intersection intersection;
+    switch (object.bakedShape)
+    {
+    case BakedShape::Sphere:
+        intersection = intersectWithSphere(ray, object.bakedPosition, object.bakedSize.x);
+        break;
+    case BakedShape::Box:
+        intersection = intersectWithBox(ray, object.bakedPosition, object.bakedPosition + object.bakedSize);
+        break;
+    case BakedShape::Cylinder:
+        intersection = intersectWithCylinder(ray, object.bakedPosition, object.bakedSize.x, object.bakedSize.y);
+        break;
+    case BakedShape::None:
+        break;
+    }
+
+    if (!intersection.isValid || ray.getT(intersection.entry.position) <= 0.001)
+    {
+        return Intersection();
+    }
+
+    // The tangents of local hits are normalized when they are transformed to world space
+    intersection.entry.tangent = glm::normalize(intersection.entry.tangent);
+    intersection.exit.tangent = glm::normalize(intersection.exit.tangent);
+
+    const GeometryNode *geometryNode = static_cast<const GeometryNode *>(object.node);
+    intersection.entry.node = geometryNode;
+    intersection.exit.node = geometryNode;
+    intersection.entry.material = geometryNode->m_material;
+    intersection.exit.material = geometryNode->m_material;
+    return intersection;
+}
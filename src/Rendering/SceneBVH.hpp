@@ -0,0 +1,154 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <glm/glm.hpp>
+
+#include "intersection.hpp"
+#include "../Modeling/SceneNode.hpp"
+
+class InstanceNode;
+
+// A bounding volume hierarchy over the objects of the scene, in world space. Every GeometryNode is an
+// object, and so is every BooleanNode (together with the CSG tree below it).
+//
+// Every InstanceNode is an object as well. The prototype of an instance gets a tree of its own (in the
+// space of the prototype), which is shared by every instance of it. With auto instancing, subtrees that
+// occur more than once are found by hashing them, and are turned into instances the same way.
+//
+// When only transforms change (e.g. between the frames of an animation), the bounds are refit from the
+// bottom up in O(n) instead of building the tree again. Refitting lets the quality of the tree drift, so
+// the surface area heuristic (SAH) cost is tracked, and the tree is rebuilt once it gets too much worse.
+//
+// Spheres, cubes and cylinders whose transforms only translate and scale them (uniformly for spheres, and
+// the same in X and Z for cylinders) are baked into world space, like NonhierSphere and NonhierBox, so
+// rays are intersected with them directly instead of being transformed into their local space.
+class SceneBVH
+{
+public:
+    SceneBVH();
+    SceneBVH(const SceneBVH &) = delete;
+    SceneBVH &operator=(const SceneBVH &) = delete;
+
+    // Bring the tree up to date with the scene
+    void update(SceneNode *root);
+
+    // Render subtrees that occur more than once as instances of one prototype
+    void setAutoInstancing(bool enabled);
+
+    // Find the closest intersection along the ray, like a traversal of the whole scene graph would
+    Intersection intersect(const Ray &ray) const;
+
+    size_t objectCount() const;
+
+private:
+    // The trees of the prototypes, by their root and whether the transform of the root is part of the prototype
+    // (it is for InstanceNodes, but the duplicates that auto instancing finds each keep their own)
+    typedef std::map<std::pair<const SceneNode *, bool>, std::unique_ptr<SceneBVH>> PrototypeMap;
+
+    // The tree of a prototype, which shares the prototypes of the tree that owns the map
+    SceneBVH(PrototypeMap *prototypes, bool includeRootTransform);
+
+    // An object found while walking the scene, with its transform relative to the root
+    struct ObjectSource
+    {
+        const SceneNode *node;
+        glm::mat4 transform;
+        // The tree of the prototype, for instances
+        const SceneBVH *prototype;
+        // Whether the node is an InstanceNode whose material overrides those of its prototype. Subtrees that are
+        // automatically instanced leave the override to the InstanceNodes inside their tree.
+        bool overridesMaterial;
+    };
+
+    // The world space form of a primitive with a transform that could be baked into it
+    enum class BakedShape : uint8_t
+    {
+        None,
+        // A sphere around position, with a radius of size.x
+        Sphere,
+        // A box from position to position + size
+        Box,
+        // A cylinder standing on position, with a radius of size.x and a height of size.y
+        Cylinder
+    };
+
+    struct Object
+    {
+        const SceneNode *node;
+        const SceneBVH *prototype;
+        // The InstanceNode whose material replaces those of the prototype, or null if nothing is replaced
+        const InstanceNode *instance;
+        // Where the object was found in the walk of the scene, so that refitting can match it up again
+        uint32_t sourceIndex;
+        glm::mat4 worldToLocal;
+        glm::mat4 localToWorld;
+        glm::mat3 normalToWorld;
+        AABB bounds;
+        BakedShape bakedShape;
+        glm::vec3 bakedPosition;
+        glm::vec3 bakedSize;
+    };
+
+    struct Node
+    {
+        AABB bounds;
+        // For inner nodes, the index of the right child (the left child always directly follows its
+        // parent). For leaves, the index of the first object.
+        uint32_t index;
+        // The number of objects in a leaf, or 0 for inner nodes
+        uint16_t objectCount;
+        // The axis that inner nodes are split on, used to visit the nearest child first
+        uint16_t axis;
+    };
+
+    // What is known about each subtree of the scene, to find the ones that occur more than once
+    struct DuplicateSearch
+    {
+        struct Subtree
+        {
+            size_t hash;
+            uint32_t objectCount;
+            // Subtrees with area lights cannot be instances, since each light needs its own position
+            bool instanceable;
+        };
+
+        std::unordered_map<const SceneNode *, Subtree> subtrees;
+        std::unordered_map<size_t, uint32_t> counts;
+        // The first subtree found of each kind, which becomes the prototype
+        std::unordered_map<size_t, std::vector<const SceneNode *>> representatives;
+    };
+
+    static const DuplicateSearch::Subtree &hashSubtree(const SceneNode *node, DuplicateSearch &search);
+    static void countSubtrees(const SceneNode *node, DuplicateSearch &search);
+    static bool sameSubtree(const SceneNode *a, const SceneNode *b);
+
+    void collectObjects(const SceneNode *node, const glm::mat4 &transform, std::vector<ObjectSource> &sources, DuplicateSearch *search);
+    SceneBVH *prototypeBVH(const SceneNode *root, bool includeRootTransform);
+    static AABB subtreeBounds(const SceneNode *node, const glm::mat4 &parentTransform);
+
+    void setObject(Object &object, const ObjectSource &source);
+    static void bakeObject(Object &object);
+    void build(const std::vector<ObjectSource> &sources);
+    uint32_t buildNode(uint32_t begin, uint32_t end, int depth);
+    void refit(const std::vector<ObjectSource> &sources);
+    float cost() const;
+    void intersectObject(const Object &object, const Ray &ray, Intersection &closest, float &closestT) const;
+    static Intersection intersectBakedObject(const Object &object, const Ray &ray);
+
+    std::vector<Object> objects;
+    std::vector<Node> nodes;
+
+    // The objects in the order they were found, to find out if objects were added or removed
+    std::vector<std::pair<const SceneNode *, const SceneBVH *>> objectKeys;
+    unsigned long long generation = 0;
+    bool built = false;
+    float builtCost = 0.0f;
+
+    bool autoInstancing = false;
+    bool includeRootTransform = true;
+    PrototypeMap ownPrototypes;
+    PrototypeMap *prototypes;
+};
@@ -0,0 +1,166 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <csignal>
+#include <unistd.h>
+
+#include "Telemetry.hpp"
+
+// The number of threads that get their own slot. Any threads after that share the last slot.
+const size_t MAX_TELEMETRY_SLOTS = 256;
+
+static TelemetrySlot slots[MAX_TELEMETRY_SLOTS];
+static std::atomic<size_t> slots_claimed{0};
+
+TelemetrySlot &claimTelemetrySlot()
+{
+    size_t index = slots_claimed.fetch_add(1);
+    return slots[std::min(index, MAX_TELEMETRY_SLOTS - 1)];
+}
+
+TelemetryTotals readTelemetry()
+{
+    TelemetryTotals totals = {};
+    size_t slot_count = std::min(slots_claimed.load(), MAX_TELEMETRY_SLOTS);
+    for (size_t i = 0; i < slot_count; ++i)
+    {
+        for (size_t counter = 0; counter < TELEMETRY_COUNTER_COUNT; ++counter)
+        {
+            totals[counter] += slots[i].counters[counter].load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
+
+// Append a number to the buffer. Formatting functions like snprintf are not safe to use in a signal handler.
+static size_t appendNumber(char *buffer, size_t length, uint64_t number)
+{
+    char digits[20];
+    size_t digit_count = 0;
+    do
+    {
+        digits[digit_count++] = '0' + number % 10;
+        number /= 10;
+    } while (number > 0);
+
+    while (digit_count > 0)
+    {
+        buffer[length++] = digits[--digit_count];
+    }
+    return length;
+}
+
+static size_t appendString(char *buffer, size_t length, const char *string)
+{
+    while (*string)
+    {
+        buffer[length++] = *string++;
+    }
+    return length;
+}
+
+static void telemetrySignalHandler(int)
+{
+    static const char *names[TELEMETRY_COUNTER_COUNT] = {"camera rays", "shadow rays", "reflection rays", "transmission rays", "pixels"};
+
+    TelemetryTotals totals = readTelemetry();
+    char buffer[256];
+    size_t length = appendString(buffer, 0, "Telemetry:");
+    for (size_t counter = 0; counter < TELEMETRY_COUNTER_COUNT; ++counter)
+    {
+        length = appendString(buffer, length, " ");
+        length = appendNumber(buffer, length, totals[counter]);
+        length = appendString(buffer, length, " ");
+        length = appendString(buffer, length, names[counter]);
+        length = appendString(buffer, length, counter + 1 < TELEMETRY_COUNTER_COUNT ? "," : "\n");
+    }
+
+    ssize_t written = write(STDERR_FILENO, buffer, length);
+    (void)written;
+}
+
+void installTelemetrySignalHandler()
+{
+    struct sigaction action = {};
+    action.sa_handler = telemetrySignalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+}
+
+TelemetryReporter::TelemetryReporter(uint64_t total_pixels_, double interval_seconds)
+    : total_pixels(total_pixels_), interval(interval_seconds), start_totals(readTelemetry()), start_time(std::chrono::steady_clock::now()),
+      last_totals(start_totals), last_time(start_time)
+{
+    thread = std::thread(&TelemetryReporter::run, this);
+}
+
+void TelemetryReporter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopped_condition.wait_for(lock, interval, [this]()
+                                       { return stopped; }))
+    {
+        report(false);
+    }
+}
+
+// Print the progress since the start of the render, and the throughput since the last report
+void TelemetryReporter::report(bool final)
+{
+    TelemetryTotals totals = readTelemetry();
+    auto now = std::chrono::steady_clock::now();
+
+    uint64_t pixels = totals[PixelsDone] - start_totals[PixelsDone];
+    uint64_t rays = 0;
+    uint64_t last_rays = 0;
+    for (size_t counter = CameraRays; counter <= TransmissionRays; ++counter)
+    {
+        rays += totals[counter] - start_totals[counter];
+        last_rays += totals[counter] - last_totals[counter];
+    }
+
+    double elapsed = std::chrono::duration<double>(now - start_time).count();
+    double seconds = final ? elapsed : std::chrono::duration<double>(now - last_time).count();
+    double rays_per_second = (final ? rays : last_rays) / std::max(seconds, 1e-9);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Progress: " << 100.0 * pixels / std::max<uint64_t>(total_pixels, 1) << "% (" << pixels << "/" << total_pixels << " pixels), "
+              << rays_per_second / 1e6 << "M rays/s";
+    if (final)
+    {
+        std::cout << ", done in " << elapsed << "s (" << totals[CameraRays] - start_totals[CameraRays] << " camera, "
+                  << totals[ShadowRays] - start_totals[ShadowRays] << " shadow, "
+                  << totals[ReflectionRays] - start_totals[ReflectionRays] << " reflection, "
+                  << totals[TransmissionRays] - start_totals[TransmissionRays] << " transmission rays)";
+    }
+    else if (pixels > 0)
+    {
+        std::cout << ", ETA " << elapsed * (total_pixels - std::min(pixels, total_pixels)) / pixels << "s";
+    }
+    std::cout << std::defaultfloat << std::setprecision(6) << std::endl;
+
+    last_totals = totals;
+    last_time = now;
+}
+
+void TelemetryReporter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopped)
+        {
+            return;
+        }
+        stopped = true;
+    }
+    stopped_condition.notify_one();
+    thread.join();
+
+    report(true);
+}
+
+TelemetryReporter::~TelemetryReporter()
+{
+    stop();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+// The events that are counted while rendering
+enum TelemetryCounter
+{
+    CameraRays,
+    ShadowRays,
+    ReflectionRays,
+    TransmissionRays,
+    PixelsDone,
+    TELEMETRY_COUNTER_COUNT
+};
+
+// The counters of a single thread. Every slot has its own cache line, so threads never write to the same one.
+struct alignas(64) TelemetrySlot
+{
+    std::atomic<uint64_t> counters[TELEMETRY_COUNTER_COUNT];
+};
+
+// A sum of the counters of every thread
+typedef std::array<uint64_t, TELEMETRY_COUNTER_COUNT> TelemetryTotals;
+
+// The slot of the calling thread. Threads claim a slot the first time they count something.
+TelemetrySlot &claimTelemetrySlot();
+
+inline TelemetrySlot &telemetrySlot()
+{
+    static thread_local TelemetrySlot *slot = &claimTelemetrySlot();
+    return *slot;
+}
+
+// Count an event on the calling thread. Only this thread writes to its slot, so this never contends.
+inline void addTelemetry(TelemetryCounter counter, uint64_t amount = 1)
+{
+    telemetrySlot().counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+// Sum the counters of every thread. This only does atomic loads, so it is safe to call from a signal handler.
+TelemetryTotals readTelemetry();
+
+// Make SIGUSR1 print the current counters to stderr
+void installTelemetrySignalHandler();
+
+// A thread that prints the progress, ray throughput and ETA of a render at a fixed interval
+class TelemetryReporter
+{
+public:
+    TelemetryReporter(uint64_t total_pixels, double interval_seconds);
+
+    // Stop the reporter thread and print a summary of the whole render
+    void stop();
+
+    ~TelemetryReporter();
+
+private:
+    void run();
+    void report(bool final);
+
+    const uint64_t total_pixels;
+    const std::chrono::duration<double> interval;
+    const TelemetryTotals start_totals;
+    const std::chrono::steady_clock::time_point start_time;
+    TelemetryTotals last_totals;
+    std::chrono::steady_clock::time_point last_time;
+
+    std::mutex mutex;
+    std::condition_variable stopped_condition;
+    bool stopped = false;
+    std::thread thread;
+};
@@ -0,0 +1,924 @@
+#include "Texture.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <lodepng/lodepng.h>
+
+#include "TextureCache.hpp"
+
+//---------------------------------------------------------------------------------------
+// The value of every 8-bit component, so that decoding a colour needs no division
+static const struct ComponentTable
+{
+	ComponentTable()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			values[i] = i / 255.0f;
+		}
+	}
+
+	float values[256];
+} componentTable;
+
+// Texels are stored in square tiles of this many texels on each side, so that texels that are close
+// together in the texture are close together in memory, whichever direction the lookups move in.
+// A tile of 8x8 texels is 256 bytes, or 4 cache lines. Compressed textures store tiles of 8x8 blocks
+// of texels the same way.
+const uint TILE_SIZE_BITS = 3;
+const uint TILE_SIZE = 1 << TILE_SIZE_BITS;
+const uint TILE_TEXELS = TILE_SIZE * TILE_SIZE;
+
+// The bits of a coordinate within a tile, spread out to every other bit. The texels of a tile are in
+// Z-order (Morton order), so each 2x2, 4x4 block of a tile is contiguous as well.
+static const uint32_t tileSpread[TILE_SIZE] = {0, 1, 4, 5, 16, 17, 20, 21};
+
+// Compressed textures store blocks of 4x4 texels, in this many 32-bit words
+const uint BLOCK_SIZE = 4;
+const uint COLOR_BLOCK_WORDS = 2;
+const uint NORMAL_BLOCK_WORDS = 4;
+
+// How far each index of a colour block is from the first endpoint to the second
+static const float colorBlockWeights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+// Cache files start with this header, followed by the canonical path of the PNG file, and then
+// by the texels of every level, in the same order and layout as in memory
+struct CacheFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t encoding;
+	uint32_t compression;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levelCount;
+	uint32_t pathLength;
+	int64_t sourceModified;
+	uint64_t sourceSize;
+	// Where the texels start, aligned to a cache line
+	uint64_t texelOffset;
+};
+
+static const char CACHE_FILE_MAGIC[8] = {'R', 'T', 'T', 'E', 'X', 'C', 'H', 'E'};
+// Changes whenever the layout of the texels changes, so that older cache files are written again
+const uint32_t CACHE_FILE_VERSION = 2;
+
+//---------------------------------------------------------------------------------------
+static uint32_t packColor(const unsigned char *rgba)
+{
+	return (uint32_t)rgba[0] | (uint32_t)rgba[1] << 8 | (uint32_t)rgba[2] << 16 | (uint32_t)rgba[3] << 24;
+}
+
+//---------------------------------------------------------------------------------------
+static uint32_t packSnorm16(float x, float y)
+{
+	uint16_t u = (uint16_t)(int16_t)glm::round(glm::clamp(x, -1.0f, 1.0f) * 32767.0f);
+	uint16_t v = (uint16_t)(int16_t)glm::round(glm::clamp(y, -1.0f, 1.0f) * 32767.0f);
+	return (uint32_t)u | (uint32_t)v << 16;
+}
+
+//---------------------------------------------------------------------------------------
+// Project the unit normal onto the octahedron |x| + |y| + |z| = 1, and unfold the lower
+// half over the upper one, so that it can be stored as a point in [-1, 1]^2.
+static uint32_t encodeNormal(const glm::vec3 &normal)
+{
+	glm::vec3 n = normal / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+	if (n.z < 0.0f)
+	{
+		float x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		float y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+		return packSnorm16(x, y);
+	}
+
+	return packSnorm16(n.x, n.y);
+}
+
+//---------------------------------------------------------------------------------------
+static glm::vec3 decodeOctahedral(float x, float y)
+{
+	glm::vec3 n(x, y, 1.0f - std::abs(x) - std::abs(y));
+	if (n.z < 0.0f)
+	{
+		float fold = -n.z;
+		n.x += n.x >= 0.0f ? -fold : fold;
+		n.y += n.y >= 0.0f ? -fold : fold;
+	}
+
+	return glm::normalize(n);
+}
+
+//---------------------------------------------------------------------------------------
+static glm::vec3 decodeNormal(uint32_t texel)
+{
+	return decodeOctahedral((int16_t)(texel & 0xffff) / 32767.0f, (int16_t)(texel >> 16) / 32767.0f);
+}
+
+//---------------------------------------------------------------------------------------
+// An RGB565 endpoint of a colour block, with components in [0, 255]
+static glm::vec3 unpack565(uint32_t color)
+{
+	uint r = (color >> 11) & 31;
+	uint g = (color >> 5) & 63;
+	uint b = color & 31;
+	return glm::vec3(r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2);
+}
+
+//---------------------------------------------------------------------------------------
+static uint32_t pack565(const glm::vec3 &color)
+{
+	glm::vec3 c = glm::clamp(color, 0.0f, 255.0f);
+	return (uint32_t)std::lround(c.r * 31.0f / 255.0f) << 11 |
+		   (uint32_t)std::lround(c.g * 63.0f / 255.0f) << 5 |
+		   (uint32_t)std::lround(c.b * 31.0f / 255.0f);
+}
+
+//---------------------------------------------------------------------------------------
+// Pick the nearest of the 4 colours between the endpoints for every texel of a block, and
+// return the squared error
+static float chooseColorIndices(const glm::vec3 colors[16], uint32_t endpoints, uint32_t &indices)
+{
+	glm::vec3 e0 = unpack565(endpoints & 0xffff);
+	glm::vec3 e1 = unpack565(endpoints >> 16);
+	glm::vec3 palette[4];
+	for (int k = 0; k < 4; ++k)
+	{
+		palette[k] = glm::mix(e0, e1, colorBlockWeights[k]);
+	}
+
+	indices = 0;
+	float error = 0.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		uint best = 0;
+		float bestDistance = glm::dot(colors[i] - palette[0], colors[i] - palette[0]);
+		for (uint k = 1; k < 4; ++k)
+		{
+			float distance = glm::dot(colors[i] - palette[k], colors[i] - palette[k]);
+			if (distance < bestDistance)
+			{
+				best = k;
+				bestDistance = distance;
+			}
+		}
+		indices |= best << (2 * i);
+		error += bestDistance;
+	}
+
+	return error;
+}
+
+//---------------------------------------------------------------------------------------
+// Encode the 16 RGBA8 texels of a block as a pair of RGB565 endpoints and a 2-bit index per
+// texel. The endpoints start at the extremes of the colours along their principal axis, and
+// are then fitted to the chosen indices by least squares.
+static void encodeColorBlock(const uint32_t texels[16], uint32_t block[2])
+{
+	glm::vec3 colors[16];
+	glm::vec3 mean(0.0f);
+	for (int i = 0; i < 16; ++i)
+	{
+		colors[i] = glm::vec3(texels[i] & 0xff, (texels[i] >> 8) & 0xff, (texels[i] >> 16) & 0xff);
+		mean += colors[i];
+	}
+	mean /= 16.0f;
+
+	glm::mat3 covariance(0.0f);
+	for (int i = 0; i < 16; ++i)
+	{
+		covariance += glm::outerProduct(colors[i] - mean, colors[i] - mean);
+	}
+
+	// Power iteration, from the column with the most variance
+	glm::vec3 axis = covariance[0];
+	for (int c = 1; c < 3; ++c)
+	{
+		if (glm::dot(covariance[c], covariance[c]) > glm::dot(axis, axis))
+		{
+			axis = covariance[c];
+		}
+	}
+	for (int iteration = 0; iteration < 8 && glm::length(axis) > 1e-6f; ++iteration)
+	{
+		axis = glm::normalize(covariance * axis);
+	}
+
+	float tMin = 0.0f;
+	float tMax = 0.0f;
+	if (glm::length(axis) > 1e-6f)
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			float t = glm::dot(colors[i] - mean, axis);
+			tMin = std::min(tMin, t);
+			tMax = std::max(tMax, t);
+		}
+	}
+
+	uint32_t endpoints = pack565(mean + axis * tMin) | pack565(mean + axis * tMax) << 16;
+	uint32_t indices;
+	float error = chooseColorIndices(colors, endpoints, indices);
+
+	// Solve for the endpoints that best fit the colours with these indices
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	glm::vec3 ax(0.0f), bx(0.0f);
+	for (int i = 0; i < 16; ++i)
+	{
+		float b = colorBlockWeights[(indices >> (2 * i)) & 3];
+		float a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		ax += a * colors[i];
+		bx += b * colors[i];
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (std::abs(determinant) > 1e-6f)
+	{
+		glm::vec3 e0 = (ax * bb - bx * ab) / determinant;
+		glm::vec3 e1 = (bx * aa - ax * ab) / determinant;
+		uint32_t fitted = pack565(e0) | pack565(e1) << 16;
+		uint32_t fittedIndices;
+		if (chooseColorIndices(colors, fitted, fittedIndices) < error)
+		{
+			endpoints = fitted;
+			indices = fittedIndices;
+		}
+	}
+
+	block[0] = endpoints;
+	block[1] = indices;
+}
+
+//---------------------------------------------------------------------------------------
+static glm::vec3 decodeColorBlock(const uint32_t *block, uint texel)
+{
+	glm::vec3 e0 = unpack565(block[0] & 0xffff);
+	glm::vec3 e1 = unpack565(block[0] >> 16);
+	return glm::mix(e0, e1, colorBlockWeights[(block[1] >> (2 * texel)) & 3]) * (1.0f / 255.0f);
+}
+
+//---------------------------------------------------------------------------------------
+// Encode 16 values in [-1, 1] as a pair of signed 8-bit endpoints (in the low 16 bits) and a
+// 3-bit index per value into the 8 values evenly spaced between them
+static uint64_t encodeChannelBlock(const float values[16])
+{
+	float lowest = *std::min_element(values, values + 16);
+	float highest = *std::max_element(values, values + 16);
+	int e0 = glm::clamp((int)std::floor(lowest * 127.0f), -127, 127);
+	int e1 = glm::clamp((int)std::ceil(highest * 127.0f), -127, 127);
+
+	uint64_t bits = (uint64_t)(uint8_t)(int8_t)e0 | (uint64_t)(uint8_t)(int8_t)e1 << 8;
+	if (e1 == e0)
+	{
+		return bits;
+	}
+
+	for (int i = 0; i < 16; ++i)
+	{
+		float position = (values[i] * 127.0f - e0) / (e1 - e0) * 7.0f;
+		uint64_t index = glm::clamp((int)std::lround(position), 0, 7);
+		bits |= index << (16 + 3 * i);
+	}
+
+	return bits;
+}
+
+//---------------------------------------------------------------------------------------
+static float decodeChannelBlock(uint64_t bits, uint texel)
+{
+	float e0 = (int8_t)(bits & 0xff);
+	float e1 = (int8_t)((bits >> 8) & 0xff);
+	uint index = (bits >> (16 + 3 * texel)) & 7;
+	return (e0 + (e1 - e0) * (index / 7.0f)) / 127.0f;
+}
+
+//---------------------------------------------------------------------------------------
+// Encode the 16 octahedral normals of a block as a block of each coordinate
+static void encodeNormalBlock(const uint32_t texels[16], uint32_t block[4])
+{
+	float x[16];
+	float y[16];
+	for (int i = 0; i < 16; ++i)
+	{
+		x[i] = (int16_t)(texels[i] & 0xffff) / 32767.0f;
+		y[i] = (int16_t)(texels[i] >> 16) / 32767.0f;
+	}
+
+	uint64_t xBits = encodeChannelBlock(x);
+	uint64_t yBits = encodeChannelBlock(y);
+	block[0] = (uint32_t)xBits;
+	block[1] = (uint32_t)(xBits >> 32);
+	block[2] = (uint32_t)yBits;
+	block[3] = (uint32_t)(yBits >> 32);
+}
+
+//---------------------------------------------------------------------------------------
+static glm::vec3 decodeNormalBlock(const uint32_t *block, uint texel)
+{
+	float x = decodeChannelBlock(block[0] | (uint64_t)block[1] << 32, texel);
+	float y = decodeChannelBlock(block[2] | (uint64_t)block[3] << 32, texel);
+	return decodeOctahedral(x, y);
+}
+
+//---------------------------------------------------------------------------------------
+// The number of tiles needed to cover a row or column of elements
+static uint tilesAcross(uint elements)
+{
+	return (elements + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+//---------------------------------------------------------------------------------------
+// A hash of the path that stays the same from one run to the next, unlike std::hash
+static uint64_t hashPath(const std::string &path)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : path)
+	{
+		hash = (hash ^ c) * 1099511628211ull;
+	}
+
+	return hash;
+}
+
+//---------------------------------------------------------------------------------------
+// Read only the header of the file, for the size of the texture. The texels are decoded
+// when they are first sampled.
+Texture::Texture(const std::string &filename, Encoding encoding, Compression compression)
+	: m_filename(filename), m_encoding(encoding), m_compression(compression), m_sourceModified(0), m_sourceSize(0),
+	  m_mapping(nullptr), m_mappingSize(0), m_cacheWritten(false)
+{
+	// The signature and the IHDR chunk, which hold the size of the image
+	unsigned char header[33] = {};
+	std::ifstream file(filename, std::ios::binary);
+	file.read((char *)header, sizeof(header));
+
+	lodepng::State state;
+	unsigned error = lodepng_inspect(&m_width, &m_height, &state, header, file.gcount());
+	if (error)
+	{
+		std::cerr << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+		throw std::runtime_error("Error decoding PNG file");
+	}
+
+	// Levels of half the size of the one before (rounded down), down to a single texel
+	m_levelCount = 1;
+	for (uint width = m_width, height = m_height; width > 1 || height > 1; ++m_levelCount)
+	{
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+
+	m_levels.reset(new Level[m_levelCount]);
+	for (uint i = 0; i < m_levelCount; ++i)
+	{
+		Level &level = m_levels[i];
+		level.width = std::max(m_width >> i, 1u);
+		level.height = std::max(m_height >> i, 1u);
+		if (m_compression == Compression::None)
+		{
+			level.tilesPerRow = tilesAcross(level.width);
+			level.wordCount = (size_t)level.tilesPerRow * tilesAcross(level.height) * TILE_TEXELS;
+		}
+		else
+		{
+			level.tilesPerRow = tilesAcross((level.width + BLOCK_SIZE - 1) / BLOCK_SIZE);
+			level.wordCount = (size_t)level.tilesPerRow * tilesAcross((level.height + BLOCK_SIZE - 1) / BLOCK_SIZE) * TILE_TEXELS * blockWords();
+		}
+		level.texels.store(nullptr);
+		level.lastUse.store(0);
+	}
+
+	// Cache files are named after the PNG file and how it is decoded, so that a file which
+	// changes replaces its old cache file instead of adding another one
+	std::string directory = TextureCache::global().directory();
+	struct stat source;
+	char resolved[PATH_MAX];
+	if (!directory.empty() && stat(filename.c_str(), &source) == 0 && realpath(filename.c_str(), resolved) != nullptr)
+	{
+		m_sourcePath = resolved;
+		m_sourceModified = (int64_t)source.st_mtim.tv_sec * 1000000000 + source.st_mtim.tv_nsec;
+		m_sourceSize = source.st_size;
+
+		std::string name = m_sourcePath.substr(m_sourcePath.find_last_of('/') + 1);
+		std::ostringstream path;
+		path << directory << "/" << name << "-" << std::hex << std::setw(16) << std::setfill('0')
+			 << hashPath(m_sourcePath + (m_encoding == Encoding::Normal ? ":normal" : ":color") +
+						 (m_compression == Compression::Block ? ":block" : "")) << ".tex";
+		m_cachePath = path.str();
+	}
+
+	if (!m_cachePath.empty() && mapCacheFile())
+	{
+		TextureCache::global().addMapped();
+		return;
+	}
+
+	TextureCache::global().addTexture(this);
+}
+
+//---------------------------------------------------------------------------------------
+Texture::~Texture()
+{
+	if (m_mapping != nullptr)
+	{
+		munmap(m_mapping, m_mappingSize);
+		return;
+	}
+
+	TextureCache::global().removeTexture(this);
+}
+
+//---------------------------------------------------------------------------------------
+// Point every level at its texels in the cache file, if there is one that was written from
+// the PNG file as it is now. The pages of the file are only read when they are sampled.
+bool Texture::mapCacheFile()
+{
+	int file = open(m_cachePath.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || (size_t)info.st_size < sizeof(CacheFileHeader))
+	{
+		close(file);
+		return false;
+	}
+
+	size_t size = info.st_size;
+	void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (mapping == MAP_FAILED)
+	{
+		return false;
+	}
+
+	const CacheFileHeader &header = *(const CacheFileHeader *)mapping;
+	size_t expectedSize = header.texelOffset;
+	for (uint i = 0; i < m_levelCount; ++i)
+	{
+		expectedSize += m_levels[i].wordCount * sizeof(uint32_t);
+	}
+
+	bool valid = std::memcmp(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+				 header.version == CACHE_FILE_VERSION &&
+				 header.encoding == (uint32_t)m_encoding &&
+				 header.compression == (uint32_t)m_compression &&
+				 header.width == m_width && header.height == m_height && header.levelCount == m_levelCount &&
+				 header.sourceModified == m_sourceModified && header.sourceSize == m_sourceSize &&
+				 header.pathLength == m_sourcePath.size() &&
+				 sizeof(CacheFileHeader) + header.pathLength <= size &&
+				 m_sourcePath.compare(0, std::string::npos, (const char *)mapping + sizeof(CacheFileHeader), header.pathLength) == 0 &&
+				 expectedSize == size;
+	if (!valid)
+	{
+		munmap(mapping, size);
+		return false;
+	}
+
+	uint32_t *texels = (uint32_t *)((char *)mapping + header.texelOffset);
+	for (uint i = 0; i < m_levelCount; ++i)
+	{
+		m_levels[i].texels.store(texels);
+		texels += m_levels[i].wordCount;
+	}
+
+	m_mapping = mapping;
+	m_mappingSize = size;
+	return true;
+}
+
+//---------------------------------------------------------------------------------------
+// Write the decoded levels to the cache file. The file is written under another name and
+// then renamed, so that other runs never map a file that is only partly written.
+void Texture::writeCacheFile(const std::vector<std::unique_ptr<uint32_t[]>> &levels) const
+{
+	CacheFileHeader header;
+	std::memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_FILE_VERSION;
+	header.encoding = (uint32_t)m_encoding;
+	header.compression = (uint32_t)m_compression;
+	header.width = m_width;
+	header.height = m_height;
+	header.levelCount = m_levelCount;
+	header.pathLength = m_sourcePath.size();
+	header.sourceModified = m_sourceModified;
+	header.sourceSize = m_sourceSize;
+	header.texelOffset = (sizeof(CacheFileHeader) + m_sourcePath.size() + 63) / 64 * 64;
+
+	std::string temporaryPath = m_cachePath + "." + std::to_string(getpid()) + ".tmp";
+	mkdir(m_cachePath.substr(0, m_cachePath.find_last_of('/')).c_str(), 0755);
+	std::ofstream file(temporaryPath, std::ios::binary);
+
+	std::vector<char> padding(header.texelOffset - sizeof(CacheFileHeader) - m_sourcePath.size(), 0);
+	file.write((const char *)&header, sizeof(header));
+	file.write(m_sourcePath.data(), m_sourcePath.size());
+	file.write(padding.data(), padding.size());
+	for (uint i = 0; i < m_levelCount; ++i)
+	{
+		file.write((const char *)levels[i].get(), m_levels[i].wordCount * sizeof(uint32_t));
+	}
+	file.close();
+
+	if (!file || std::rename(temporaryPath.c_str(), m_cachePath.c_str()) != 0)
+	{
+		std::cerr << "WARNING: could not write the texture cache file " << m_cachePath << std::endl;
+		std::remove(temporaryPath.c_str());
+	}
+}
+
+//---------------------------------------------------------------------------------------
+// Where the texel (or block) at (x, y) of a level is stored: the tiles are in row-major order, and the
+// texels of each tile in Z-order.
+size_t Texture::tileIndex(uint tilesPerRow, uint x, uint y)
+{
+	size_t tile = (size_t)(y >> TILE_SIZE_BITS) * tilesPerRow + (x >> TILE_SIZE_BITS);
+	uint32_t inTile = tileSpread[x & (TILE_SIZE - 1)] | tileSpread[y & (TILE_SIZE - 1)] << 1;
+	return tile * TILE_TEXELS + inTile;
+}
+
+//---------------------------------------------------------------------------------------
+uint Texture::blockWords() const
+{
+	return m_encoding == Encoding::Normal ? NORMAL_BLOCK_WORDS : COLOR_BLOCK_WORDS;
+}
+
+//---------------------------------------------------------------------------------------
+// The texels of a level, loading them if they are not in memory. Must be called in a
+// TextureCache::ReadSection, which keeps the texels alive if the level is evicted.
+const uint32_t *Texture::acquireLevel(uint level) const
+{
+	Level &l = m_levels[level];
+
+	// Only write the time when it changes, so that lookups do not keep writing to a shared cache line
+	uint64_t now = TextureCache::global().now();
+	if (l.lastUse.load(std::memory_order_relaxed) != now)
+	{
+		l.lastUse.store(now, std::memory_order_relaxed);
+	}
+
+	const uint32_t *texels = l.texels.load(std::memory_order_acquire);
+	return texels != nullptr ? texels : loadLevels(level);
+}
+
+//---------------------------------------------------------------------------------------
+void Texture::preload() const
+{
+	if (m_mapping == nullptr && m_levels[0].texels.load(std::memory_order_acquire) == nullptr)
+	{
+		loadLevels(0);
+	}
+}
+
+//---------------------------------------------------------------------------------------
+// Load the given level and the smaller ones below it that are not in memory, and return
+// the texels of the given level. PNG files can only be decoded as a whole, so the whole
+// pyramid is rebuilt, and the larger levels that fit in half the budget of the cache are
+// kept as well, so that the file is not decoded again as soon as a closer lookup needs one.
+const uint32_t *Texture::loadLevels(uint first) const
+{
+	TextureCache &cache = TextureCache::global();
+	const uint32_t *result;
+	size_t bytes = 0;
+	uint64_t count = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_loadMutex);
+
+		// Another thread may have loaded it while this one waited
+		result = m_levels[first].texels.load(std::memory_order_acquire);
+		if (result != nullptr)
+		{
+			return result;
+		}
+
+		std::vector<std::unique_ptr<uint32_t[]>> levels;
+		decodeLevels(levels);
+
+		if (!m_cachePath.empty() && !m_cacheWritten)
+		{
+			writeCacheFile(levels);
+			m_cacheWritten = true;
+		}
+
+		// Keep as many of the larger levels as fit in half the budget, from the smallest up
+		uint keepFrom = first;
+		if (cache.budget() == 0)
+		{
+			keepFrom = 0;
+		}
+		else
+		{
+			size_t keptBytes = 0;
+			for (uint i = m_levelCount; i-- > 0;)
+			{
+				keptBytes += m_levels[i].wordCount * sizeof(uint32_t);
+				if (keptBytes > cache.budget() / 2)
+				{
+					break;
+				}
+				keepFrom = std::min(keepFrom, i);
+			}
+		}
+
+		uint64_t now = cache.tick();
+		for (uint i = keepFrom; i < m_levelCount; ++i)
+		{
+			Level &level = m_levels[i];
+			if (level.texels.load(std::memory_order_relaxed) != nullptr)
+			{
+				continue;
+			}
+
+			// The larger levels have not been used yet, so they are the first to be evicted
+			level.lastUse.store(i < first ? 0 : now, std::memory_order_relaxed);
+			level.texels.store(levels[i].release(), std::memory_order_release);
+			bytes += level.wordCount * sizeof(uint32_t);
+			++count;
+		}
+
+		result = m_levels[first].texels.load(std::memory_order_relaxed);
+	}
+
+	cache.addResident(bytes, count);
+	return result;
+}
+
+//---------------------------------------------------------------------------------------
+// Decode the file into the texels of every level. Each texel of a level is the average
+// of the 2x2 texels it covers in the level above.
+void Texture::decodeLevels(std::vector<std::unique_ptr<uint32_t[]>> &levels) const
+{
+	std::vector<unsigned char> image;
+	uint width, height;
+	unsigned error = lodepng::decode(image, width, height, m_filename, LCT_RGBA);
+
+	if (error)
+	{
+		std::cerr << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+		throw std::runtime_error("Error decoding PNG file");
+	}
+
+	if (width != m_width || height != m_height)
+	{
+		std::cerr << "Texture " << m_filename << " changed size since it was opened" << std::endl;
+		throw std::runtime_error("Error decoding PNG file");
+	}
+
+	// The texels of every level, in tiles of texels whether or not the texture is compressed
+	std::vector<std::unique_ptr<uint32_t[]>> texels(m_levelCount);
+	std::vector<uint> tilesPerRow(m_levelCount);
+	for (uint i = 0; i < m_levelCount; ++i)
+	{
+		tilesPerRow[i] = tilesAcross(m_levels[i].width);
+		texels[i].reset(new uint32_t[(size_t)tilesPerRow[i] * tilesAcross(m_levels[i].height) * TILE_TEXELS]());
+	}
+
+	for (uint y = 0; y < m_height; ++y)
+	{
+		for (uint x = 0; x < m_width; ++x)
+		{
+			const unsigned char *rgba = &image[4 * ((size_t)m_width * y + x)];
+			uint32_t &texel = texels[0][tileIndex(tilesPerRow[0], x, y)];
+			if (m_encoding == Encoding::Color)
+			{
+				texel = packColor(rgba);
+				continue;
+			}
+
+			glm::vec3 normal(componentTable.values[rgba[0]], componentTable.values[rgba[1]], componentTable.values[rgba[2]]);
+			normal = normal * 2.0f - 1.0f;
+			// A texel that does not hold a direction points straight out of the surface
+			texel = encodeNormal(glm::length(normal) > 0.0f ? normal : glm::vec3(0, 0, 1));
+		}
+	}
+
+	for (uint i = 1; i < m_levelCount; ++i)
+	{
+		const Level &above = m_levels[i - 1];
+		const Level &level = m_levels[i];
+		const uint32_t *aboveTexels = texels[i - 1].get();
+
+		for (uint y = 0; y < level.height; ++y)
+		{
+			uint y0 = std::min(2 * y, above.height - 1);
+			uint y1 = std::min(2 * y + 1, above.height - 1);
+			for (uint x = 0; x < level.width; ++x)
+			{
+				uint x0 = std::min(2 * x, above.width - 1);
+				uint x1 = std::min(2 * x + 1, above.width - 1);
+				uint32_t average[4] = {
+					aboveTexels[tileIndex(tilesPerRow[i - 1], x0, y0)],
+					aboveTexels[tileIndex(tilesPerRow[i - 1], x1, y0)],
+					aboveTexels[tileIndex(tilesPerRow[i - 1], x0, y1)],
+					aboveTexels[tileIndex(tilesPerRow[i - 1], x1, y1)]};
+				texels[i][tileIndex(tilesPerRow[i], x, y)] = averageTexels(average);
+			}
+		}
+	}
+
+	if (m_compression == Compression::None)
+	{
+		levels = std::move(texels);
+		return;
+	}
+
+	// Each level is compressed from the full texels of the level, not from the compressed level above
+	levels.resize(m_levelCount);
+	for (uint i = 0; i < m_levelCount; ++i)
+	{
+		levels[i].reset(new uint32_t[m_levels[i].wordCount]());
+		compressLevel(m_levels[i], texels[i].get(), tilesPerRow[i], levels[i].get());
+	}
+}
+
+//---------------------------------------------------------------------------------------
+// Compress the texels of a level into its blocks. Blocks over the edge of the level repeat
+// the last row and column.
+void Texture::compressLevel(const Level &level, const uint32_t *texels, uint texelTilesPerRow, uint32_t *blocks) const
+{
+	for (uint by = 0; by * BLOCK_SIZE < level.height; ++by)
+	{
+		for (uint bx = 0; bx * BLOCK_SIZE < level.width; ++bx)
+		{
+			uint32_t block[BLOCK_SIZE * BLOCK_SIZE];
+			for (uint i = 0; i < BLOCK_SIZE * BLOCK_SIZE; ++i)
+			{
+				uint x = std::min(bx * BLOCK_SIZE + i % BLOCK_SIZE, level.width - 1);
+				uint y = std::min(by * BLOCK_SIZE + i / BLOCK_SIZE, level.height - 1);
+				block[i] = texels[tileIndex(texelTilesPerRow, x, y)];
+			}
+
+			uint32_t *words = blocks + tileIndex(level.tilesPerRow, bx, by) * blockWords();
+			if (m_encoding == Encoding::Normal)
+			{
+				encodeNormalBlock(block, words);
+			}
+			else
+			{
+				encodeColorBlock(block, words);
+			}
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------
+uint32_t Texture::averageTexels(const uint32_t texels[4]) const
+{
+	if (m_encoding == Encoding::Normal)
+	{
+		glm::vec3 sum = decodeNormal(texels[0]) + decodeNormal(texels[1]) + decodeNormal(texels[2]) + decodeNormal(texels[3]);
+		return encodeNormal(glm::length(sum) > 0.0f ? sum : glm::vec3(0, 0, 1));
+	}
+
+	uint32_t result = 0;
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		uint32_t sum = 2;
+		for (int i = 0; i < 4; ++i)
+		{
+			sum += (texels[i] >> shift) & 0xff;
+		}
+		result |= (sum / 4) << shift;
+	}
+
+	return result;
+}
+
+//---------------------------------------------------------------------------------------
+uint Texture::width() const
+{
+	return m_width;
+}
+
+//---------------------------------------------------------------------------------------
+uint Texture::height() const
+{
+	return m_height;
+}
+
+//---------------------------------------------------------------------------------------
+Texture::Encoding Texture::encoding() const
+{
+	return m_encoding;
+}
+
+//---------------------------------------------------------------------------------------
+Texture::Compression Texture::compression() const
+{
+	return m_compression;
+}
+
+//---------------------------------------------------------------------------------------
+uint Texture::levelCount() const
+{
+	return m_levelCount;
+}
+
+//---------------------------------------------------------------------------------------
+glm::vec3 Texture::decode(uint32_t texel) const
+{
+	if (m_encoding == Encoding::Normal)
+	{
+		return decodeNormal(texel);
+	}
+
+	return glm::vec3(
+		componentTable.values[texel & 0xff],
+		componentTable.values[(texel >> 8) & 0xff],
+		componentTable.values[(texel >> 16) & 0xff]);
+}
+
+//---------------------------------------------------------------------------------------
+// The texel at (x, y) of a level, decoded from its block if the texture is compressed
+glm::vec3 Texture::fetch(const Level &level, const uint32_t *texels, uint x, uint y) const
+{
+	if (m_compression == Compression::None)
+	{
+		return decode(texels[tileIndex(level.tilesPerRow, x, y)]);
+	}
+
+	const uint32_t *block = texels + tileIndex(level.tilesPerRow, x / BLOCK_SIZE, y / BLOCK_SIZE) * blockWords();
+	uint texel = (y % BLOCK_SIZE) * BLOCK_SIZE + x % BLOCK_SIZE;
+	return m_encoding == Encoding::Normal ? decodeNormalBlock(block, texel) : decodeColorBlock(block, texel);
+}
+
+//---------------------------------------------------------------------------------------
+// Bilinearly interpolate between the 4 texels of a level around the texture coordinates
+glm::vec3 Texture::sampleLevel(const Level &level, const uint32_t *texels, const glm::vec2 &uv) const
+{
+	// Texel centers are at half-integer coordinates
+	float x = (uv.x - std::floor(uv.x)) * level.width - 0.5f;
+	float y = (uv.y - std::floor(uv.y)) * level.height - 0.5f;
+	float x0 = std::floor(x);
+	float y0 = std::floor(y);
+	float fx = x - x0;
+	float fy = y - y0;
+
+	// Wrap around the edges, since the texture repeats
+	uint left = ((int)x0 + level.width) % level.width;
+	uint right = (left + 1) % level.width;
+	uint top = ((int)y0 + level.height) % level.height;
+	uint bottom = (top + 1) % level.height;
+
+	glm::vec3 upper = glm::mix(fetch(level, texels, left, top), fetch(level, texels, right, top), fx);
+	glm::vec3 lower = glm::mix(fetch(level, texels, left, bottom), fetch(level, texels, right, bottom), fx);
+	return glm::mix(upper, lower, fy);
+}
+
+//---------------------------------------------------------------------------------------
+glm::vec3 Texture::sample(const glm::vec2 &uv, float footprint) const
+{
+	// The level where the footprint is about one texel wide
+	float lod = std::log2(std::max(footprint * std::sqrt((float)m_width * m_height), 1.0f));
+	lod = std::min(lod, (float)(m_levelCount - 1));
+
+	uint level = (uint)lod;
+	float blend = lod - level;
+	glm::vec3 result;
+	{
+		TextureCache::ReadSection section;
+		result = sampleLevel(m_levels[level], acquireLevel(level), uv);
+		if (blend > 0.0f && level + 1 < m_levelCount)
+		{
+			result = glm::mix(result, sampleLevel(m_levels[level + 1], acquireLevel(level + 1), uv), blend);
+		}
+	}
+
+	if (m_encoding == Encoding::Normal)
+	{
+		float length = glm::length(result);
+		return length > 0.0f ? result / length : glm::vec3(0, 0, 1);
+	}
+
+	return result;
+}
+
+//---------------------------------------------------------------------------------------
+size_t Texture::memorySize() const
+{
+	size_t size = 0;
+	for (uint i = 0; i < m_levelCount; ++i)
+	{
+		if (m_levels[i].texels.load() != nullptr)
+		{
+			size += m_levels[i].wordCount * sizeof(uint32_t);
+		}
+	}
+
+	return size;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+typedef unsigned int uint;
+
+/**
+ * A read-only texture loaded from a PNG file, stored compactly and decoded on lookup.
+ *
+ * Colour textures keep the 8-bit RGBA data of the PNG (4 bytes per texel, instead of the
+ * 24 bytes of an Image). Normal maps are stored as unit normals in octahedral encoding,
+ * with 16 bits for each of the two coordinates, so lookups return normalized vectors.
+ *
+ * Lookups are filtered trilinearly from a mip pyramid, with the level chosen from the
+ * size of the area that the lookup covers.
+ *
+ * The texels of each level are stored in small square tiles rather than row by row, so
+ * that lookups close together on the texture stay within a few cache lines.
+ *
+ * Only the header of the file is read when the texture is created. The levels are decoded
+ * the first time they are sampled, and the TextureCache evicts them again when the decoded
+ * textures take up more memory than its budget.
+ *
+ * Textures can also be block compressed, which trades some quality for 8 times less memory
+ * for colours and 4 times less for normal maps. Colours are stored like BC1: every 4x4 block
+ * of texels has two RGB565 endpoints and a 2-bit index per texel into the 4 colours between
+ * them. Normal maps are stored like BC5: both octahedral coordinates have two 8-bit endpoints
+ * and a 3-bit index per texel into the 8 values between them. Only the texels that a lookup
+ * needs are decoded from their block.
+ *
+ * If the TextureCache has a directory, the decoded levels are written to a file there the
+ * first time they are loaded. Textures created from the same PNG file later (as long as it
+ * has not changed) map that file instead, and never decode the PNG.
+ */
+class Texture
+{
+public:
+	enum class Encoding
+	{
+		// Colours with components in [0.0, 1.0]
+		Color,
+		// Tangent space normals, stored in the PNG as (n + 1) / 2
+		Normal
+	};
+
+	enum class Compression
+	{
+		// 4 bytes per texel
+		None,
+		// 4x4 blocks of texels in 8 bytes for colours and 16 bytes for normal maps
+		Block
+	};
+
+	// Open a texture from the given PNG file. Its texels are loaded when they are first sampled.
+	Texture(const std::string &filename, Encoding encoding, Compression compression = Compression::None);
+	~Texture();
+
+	Texture(const Texture &other) = delete;
+	Texture &operator=(const Texture &other) = delete;
+
+	uint width() const;
+	uint height() const;
+	Encoding encoding() const;
+	Compression compression() const;
+
+	uint levelCount() const;
+
+	// Look up the colour, or the unit normal for normal maps, at the given texture coordinates.
+	// The footprint is the width of the area the lookup covers, in texture coordinates (a
+	// footprint of 1 covers the whole texture). The texture repeats outside of [0, 1].
+	glm::vec3 sample(const glm::vec2 &uv, float footprint) const;
+
+	// Decode every level now, instead of when it is first sampled. Does nothing if the levels
+	// are mapped from a cache file.
+	void preload() const;
+
+	// The number of bytes used by the texels of the levels that are currently loaded
+	size_t memorySize() const;
+
+private:
+	friend class TextureCache;
+
+	struct Level
+	{
+		uint width;
+		uint height;
+		// The tiles are of texels, or of blocks of texels if the texture is compressed
+		uint tilesPerRow;
+		// The size of the level in 32-bit words, padded to whole tiles
+		size_t wordCount;
+		// The texels (or blocks), or null while the level is not loaded
+		std::atomic<uint32_t *> texels;
+		// The TextureCache time of the last lookup, for evicting the least recently used levels
+		std::atomic<uint64_t> lastUse;
+	};
+
+	static size_t tileIndex(uint tilesPerRow, uint x, uint y);
+	uint blockWords() const;
+	const uint32_t *acquireLevel(uint level) const;
+	const uint32_t *loadLevels(uint first) const;
+	void decodeLevels(std::vector<std::unique_ptr<uint32_t[]>> &levels) const;
+	void compressLevel(const Level &level, const uint32_t *texels, uint texelTilesPerRow, uint32_t *blocks) const;
+	uint32_t averageTexels(const uint32_t texels[4]) const;
+	glm::vec3 decode(uint32_t texel) const;
+	glm::vec3 fetch(const Level &level, const uint32_t *texels, uint x, uint y) const;
+	glm::vec3 sampleLevel(const Level &level, const uint32_t *texels, const glm::vec2 &uv) const;
+
+	bool mapCacheFile();
+	void writeCacheFile(const std::vector<std::unique_ptr<uint32_t[]>> &levels) const;
+
+	std::string m_filename;
+	uint m_width;
+	uint m_height;
+	Encoding m_encoding;
+	Compression m_compression;
+	uint m_levelCount;
+	std::unique_ptr<Level[]> m_levels;
+
+	// The file the decoded levels are cached in, or empty if they are not cached
+	std::string m_cachePath;
+	// The canonical path, modification time (in nanoseconds) and size of the PNG file, which
+	// the cache file must match
+	std::string m_sourcePath;
+	int64_t m_sourceModified;
+	uint64_t m_sourceSize;
+	// The cache file the levels are mapped from, or null if they are decoded
+	void *m_mapping;
+	size_t m_mappingSize;
+	mutable bool m_cacheWritten;
+
+	// Held while loading levels, so that each level is decoded once at a time
+	mutable std::mutex m_loadMutex;
+};
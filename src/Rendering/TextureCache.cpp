@@ -0,0 +1,252 @@
+#include "TextureCache.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+
+#include "Texture.hpp"
+
+TextureCache &TextureCache::global()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+TextureCache::TextureCache()
+    : m_budget(0), m_residentBytes(0), m_clock(0), m_loads(0), m_evictions(0), m_mapped(0), m_epoch(1)
+{
+}
+
+TextureCache::~TextureCache()
+{
+    for (RetiredTexels &retired : m_retired)
+    {
+        delete[] retired.texels;
+    }
+}
+
+void TextureCache::setBudget(size_t bytes)
+{
+    m_budget.store(bytes);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    evict();
+    reclaim();
+}
+
+size_t TextureCache::budget() const
+{
+    return m_budget.load();
+}
+
+size_t TextureCache::residentBytes() const
+{
+    return m_residentBytes.load();
+}
+
+void TextureCache::setDirectory(const std::string &directory)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_directory = directory;
+}
+
+std::string TextureCache::directory() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_directory;
+}
+
+void TextureCache::printStatistics() const
+{
+    uint64_t loads = m_loads.load();
+    uint64_t mapped = m_mapped.load();
+    if (loads == 0 && mapped == 0)
+    {
+        return;
+    }
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "Texture cache: " << m_residentBytes.load() / (1024.0 * 1024.0) << " MB resident";
+    if (m_budget.load() > 0)
+    {
+        std::cout << " (budget " << m_budget.load() / (1024.0 * 1024.0) << " MB)";
+    }
+    std::cout << ", " << loads << " levels loaded, " << m_evictions.load() << " evicted";
+    if (mapped > 0)
+    {
+        std::cout << ", " << mapped << " textures mapped from " << directory();
+    }
+    std::cout << std::endl;
+}
+
+TextureCache::ReadSection::ReadSection()
+    : epoch(readerSlot().epoch)
+{
+    // Announce the epoch before reading any level pointers, so that a level retired after this point
+    // is never freed while this lookup may still be using it
+    epoch.store(global().m_epoch.load());
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+TextureCache::ReadSection::~ReadSection()
+{
+    epoch.store(0, std::memory_order_release);
+}
+
+TextureCache::ReaderSlot &TextureCache::readerSlot()
+{
+    static thread_local ReaderSlot *slot = &global().claimReaderSlot();
+    return *slot;
+}
+
+TextureCache::ReaderSlot &TextureCache::claimReaderSlot()
+{
+    std::lock_guard<std::mutex> lock(m_readersMutex);
+    m_readers.push_back(std::unique_ptr<ReaderSlot>(new ReaderSlot()));
+    m_readers.back()->epoch.store(0);
+    return *m_readers.back();
+}
+
+void TextureCache::addTexture(Texture *texture)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_textures.insert(texture);
+}
+
+void TextureCache::removeTexture(Texture *texture)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_textures.erase(texture);
+
+    // Nothing samples a texture that is being destroyed, so its levels can be freed right away
+    for (uint level = 0; level < texture->m_levelCount; ++level)
+    {
+        Texture::Level &l = texture->m_levels[level];
+        uint32_t *texels = l.texels.exchange(nullptr);
+        if (texels != nullptr)
+        {
+            m_residentBytes.fetch_sub(l.wordCount * sizeof(uint32_t));
+            delete[] texels;
+        }
+    }
+}
+
+// Count a texture that maps its levels from the directory. Mapped levels are paged in and out by the
+// operating system, so the cache does not track them.
+void TextureCache::addMapped()
+{
+    m_mapped.fetch_add(1);
+}
+
+uint64_t TextureCache::now() const
+{
+    return m_clock.load(std::memory_order_relaxed);
+}
+
+uint64_t TextureCache::tick()
+{
+    return m_clock.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void TextureCache::addResident(size_t bytes, uint64_t levels)
+{
+    m_residentBytes.fetch_add(bytes);
+    m_loads.fetch_add(levels);
+
+    // Without a budget nothing is ever evicted, so there is nothing to free either
+    if (m_budget.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        evict();
+        reclaim();
+    }
+}
+
+// Evict the least recently used levels until the cache fits in the budget. Levels that were sampled since
+// the last load are never evicted, even if they alone are over the budget, since they would only be
+// loaded again by the next lookup. The caller holds m_mutex.
+void TextureCache::evict()
+{
+    size_t budget = m_budget.load();
+    if (budget == 0 || m_residentBytes.load() <= budget)
+    {
+        return;
+    }
+
+    struct Candidate
+    {
+        uint64_t lastUse;
+        Texture *texture;
+        uint level;
+    };
+
+    uint64_t current = now();
+    std::vector<Candidate> candidates;
+    for (Texture *texture : m_textures)
+    {
+        for (uint level = 0; level < texture->m_levelCount; ++level)
+        {
+            const Texture::Level &l = texture->m_levels[level];
+            uint64_t lastUse = l.lastUse.load(std::memory_order_relaxed);
+            if (l.texels.load(std::memory_order_relaxed) != nullptr && lastUse != current)
+            {
+                candidates.push_back({lastUse, texture, level});
+            }
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+              { return a.lastUse < b.lastUse; });
+
+    for (const Candidate &candidate : candidates)
+    {
+        if (m_residentBytes.load() <= budget)
+        {
+            break;
+        }
+
+        Texture::Level &level = candidate.texture->m_levels[candidate.level];
+        uint32_t *texels = level.texels.exchange(nullptr);
+        if (texels != nullptr)
+        {
+            m_residentBytes.fetch_sub(level.wordCount * sizeof(uint32_t));
+            m_evictions.fetch_add(1);
+            retire(texels);
+        }
+    }
+}
+
+// Free the texels once no lookup can be reading them any more. The caller holds m_mutex.
+void TextureCache::retire(uint32_t *texels)
+{
+    m_retired.push_back({texels, m_epoch.fetch_add(1)});
+}
+
+// Free the retired texels that no running lookup can still be reading. The caller holds m_mutex.
+void TextureCache::reclaim()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Lookups that started in an epoch after a level was retired cannot have seen it
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    {
+        std::lock_guard<std::mutex> lock(m_readersMutex);
+        for (const std::unique_ptr<ReaderSlot> &reader : m_readers)
+        {
+            uint64_t epoch = reader->epoch.load();
+            if (epoch != 0)
+            {
+                oldest = std::min(oldest, epoch);
+            }
+        }
+    }
+
+    auto freeable = std::partition(m_retired.begin(), m_retired.end(), [oldest](const RetiredTexels &retired)
+                                   { return retired.epoch >= oldest; });
+    for (auto i = freeable; i != m_retired.end(); ++i)
+    {
+        delete[] i->texels;
+    }
+    m_retired.erase(freeable, m_retired.end());
+}
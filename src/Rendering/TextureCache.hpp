@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+class Texture;
+
+// Keeps track of the decoded mip levels of every texture, and evicts the least recently used ones when
+// they take up more memory than the budget. Textures decode their levels on demand (see Texture), so an
+// evicted level is simply decoded again the next time it is sampled.
+//
+// Lookups never take a lock. A level that is evicted while a lookup may still be reading it is retired
+// instead of freed: every lookup runs in a ReadSection, which announces the epoch it started in, and
+// retired levels are freed once every lookup that started before they were retired has finished.
+class TextureCache
+{
+public:
+    // The cache of every texture in the process
+    static TextureCache &global();
+
+    // The most bytes of decoded texels to keep, or 0 for no limit
+    void setBudget(size_t bytes);
+    size_t budget() const;
+
+    size_t residentBytes() const;
+
+    // Where textures keep decoded copies of their levels, which later runs map instead of decoding
+    // the file again, or empty to always decode. Only textures created after this are affected.
+    void setDirectory(const std::string &directory);
+    std::string directory() const;
+
+    // Print how much was loaded and evicted, if any textures were sampled
+    void printStatistics() const;
+
+    // Marks the calling thread as reading texels for as long as it exists
+    class ReadSection
+    {
+    public:
+        ReadSection();
+        ~ReadSection();
+
+        ReadSection(const ReadSection &) = delete;
+        ReadSection &operator=(const ReadSection &) = delete;
+
+    private:
+        std::atomic<uint64_t> &epoch;
+    };
+
+private:
+    friend class Texture;
+
+    // The epoch that a thread's current lookup started in, or 0 if it is not in a lookup. The slots are
+    // padded so that lookups on different threads never write to the same cache line.
+    struct ReaderSlot
+    {
+        std::atomic<uint64_t> epoch;
+        char padding[128 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    struct RetiredTexels
+    {
+        uint32_t *texels;
+        uint64_t epoch;
+    };
+
+    TextureCache();
+    ~TextureCache();
+
+    static ReaderSlot &readerSlot();
+    ReaderSlot &claimReaderSlot();
+
+    void addTexture(Texture *texture);
+    void removeTexture(Texture *texture);
+    void addMapped();
+
+    // The time for the LRU order, which moves forward every time a level is loaded
+    uint64_t now() const;
+    uint64_t tick();
+
+    // Count newly decoded levels, and evict levels until the cache fits in the budget again
+    void addResident(size_t bytes, uint64_t levels);
+    void evict();
+    void retire(uint32_t *texels);
+    void reclaim();
+
+    std::atomic<size_t> m_budget;
+    std::atomic<size_t> m_residentBytes;
+    std::atomic<uint64_t> m_clock;
+    std::atomic<uint64_t> m_loads;
+    std::atomic<uint64_t> m_evictions;
+    std::atomic<uint64_t> m_mapped;
+
+    // Guards the textures, the retired texels and the directory
+    mutable std::mutex m_mutex;
+    std::string m_directory;
+    std::set<Texture *> m_textures;
+    std::vector<RetiredTexels> m_retired;
+
+    std::atomic<uint64_t> m_epoch;
+    std::mutex m_readersMutex;
+    std::vector<std::unique_ptr<ReaderSlot>> m_readers;
+};
@@ -0,0 +1,283 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+ThreadPool::ThreadPool(size_t num_threads)
+    : stopping(false)
+{
+    num_threads = std::max<size_t>(num_threads, 1);
+    workers.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        workers.emplace_back([this]()
+                             { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+ThreadPool &ThreadPool::global()
+{
+    static ThreadPool pool(defaultThreadCount());
+    return pool;
+}
+
+#ifdef __linux__
+// Read the CPU limit of a cgroup as a (rounded up) number of cores, or 0 if there is no limit
+static size_t cgroupCpuLimit()
+{
+    double quota = -1;
+    double period = 0;
+
+    // cgroup v2 has a single file of the form "<quota> <period>", where the quota may be "max"
+    std::ifstream cpuMax("/sys/fs/cgroup/cpu.max");
+    std::string quotaString;
+    if (cpuMax >> quotaString >> period)
+    {
+        if (quotaString != "max")
+        {
+            quota = std::stod(quotaString);
+        }
+    }
+    else
+    {
+        // cgroup v1 uses -1 for no quota
+        std::ifstream quotaFile("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+        std::ifstream periodFile("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+        if (!(quotaFile >> quota) || !(periodFile >> period))
+        {
+            quota = -1;
+        }
+    }
+
+    if (quota <= 0 || period <= 0)
+    {
+        return 0;
+    }
+
+    return std::max<size_t>(1, (size_t)std::ceil(quota / period));
+}
+#endif
+
+size_t ThreadPool::defaultThreadCount()
+{
+    size_t count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+#ifdef __linux__
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+    {
+        count = std::min<size_t>(count, CPU_COUNT(&cpus));
+    }
+
+    size_t limit = cgroupCpuLimit();
+    if (limit > 0)
+    {
+        count = std::min(count, limit);
+    }
+#endif
+
+    return std::max<size_t>(count, 1);
+}
+
+size_t ThreadPool::size() const
+{
+    return workers.size();
+}
+
+bool ThreadPool::pinThreads()
+{
+#ifdef __linux__
+    // Only use the cores we are allowed to run on
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return false;
+    }
+
+    std::vector<int> cores;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &allowed))
+        {
+            cores.push_back(cpu);
+        }
+    }
+
+    for (size_t i = 0; i < workers.size() && !cores.empty(); ++i)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cores[i % cores.size()], &cpus);
+        if (pthread_setaffinity_np(workers[i].native_handle(), sizeof(cpus), &cpus) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    condition.notify_one();
+}
+
+bool ThreadPool::runPendingTask()
+{
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty())
+        {
+            return false;
+        }
+
+        task = std::move(tasks.front());
+        tasks.pop_front();
+    }
+
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]()
+                           { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+            {
+                // Only reached once we are stopping and all the work is done
+                return;
+            }
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, const std::function<void(size_t)> &function, size_t grain)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+
+    // A few chunks per thread, so uneven chunks still balance out
+    size_t count = end - begin;
+    size_t chunkSize = std::max(grain, count / (4 * size()) + 1);
+
+    TaskGroup group(*this);
+    for (size_t chunkBegin = begin; chunkBegin < end; chunkBegin += chunkSize)
+    {
+        size_t chunkEnd = std::min(chunkBegin + chunkSize, end);
+        group.run([&function, chunkBegin, chunkEnd]()
+                  {
+            for (size_t i = chunkBegin; i < chunkEnd; ++i)
+            {
+                function(i);
+            } });
+    }
+    group.wait();
+}
+
+TaskGroup::TaskGroup(ThreadPool &pool_)
+    : pool(pool_), pending(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {
+        // Nobody is left to report the exception to
+    }
+}
+
+void TaskGroup::run(std::function<void()> task)
+{
+    pending++;
+    pool.submit([this, task]()
+                {
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!exception)
+            {
+                exception = std::current_exception();
+            }
+        }
+
+        // Notify while holding the lock, so the group cannot be destroyed underneath us
+        std::lock_guard<std::mutex> lock(mutex);
+        pending--;
+        condition.notify_all(); });
+}
+
+void TaskGroup::wait()
+{
+    while (pending > 0)
+    {
+        // Help run queued tasks (ours or anyone else's) rather than sitting idle
+        if (pool.runPendingTask())
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait_for(lock, std::chrono::milliseconds(1), [this]()
+                           { return pending == 0; });
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (exception)
+    {
+        std::exception_ptr rethrow = exception;
+        exception = nullptr;
+        std::rethrow_exception(rethrow);
+    }
+}
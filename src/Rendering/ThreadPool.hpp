@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <exception>
+
+// A persistent pool of worker threads that runs arbitrary tasks. There is one process-wide pool
+// (see global()) which is shared by rendering, post-processing, and scene preprocessing.
+class ThreadPool
+{
+public:
+    ThreadPool(size_t num_threads);
+    ~ThreadPool();
+
+    // The process-wide pool, created on first use with defaultThreadCount() threads
+    static ThreadPool &global();
+
+    // The number of cores this process may use. This takes the CPU affinity mask and any cgroup
+    // CPU quota (e.g. from a container) into account, on top of the number of hardware threads.
+    static size_t defaultThreadCount();
+
+    size_t size() const;
+
+    // Pin every worker thread to its own core. Returns false if this is not supported.
+    bool pinThreads();
+
+    // Queue a task, and get a future for its result
+    template <typename Function>
+    auto submit(Function &&function) -> std::future<decltype(function())>
+    {
+        typedef decltype(function()) Result;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(function));
+        std::future<Result> result = task->get_future();
+        enqueue([task]()
+                { (*task)(); });
+        return result;
+    }
+
+    // Call function(i) for every i in [begin, end). The range is split into chunks of at least
+    // grain indices, and this returns once every chunk is done.
+    void parallelFor(size_t begin, size_t end, const std::function<void(size_t)> &function, size_t grain = 1);
+
+    // Run a single queued task on the calling thread, if there is one. This lets threads that are
+    // waiting for tasks help out instead of blocking (which could otherwise deadlock the pool).
+    bool runPendingTask();
+
+private:
+    void enqueue(std::function<void()> task);
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+};
+
+// A set of tasks on a pool that can be waited for together. Waiting runs queued tasks on the
+// calling thread, so it is safe to wait on a group from inside another task.
+class TaskGroup
+{
+public:
+    TaskGroup(ThreadPool &pool = ThreadPool::global());
+
+    // Waits for any tasks that are still running
+    ~TaskGroup();
+
+    void run(std::function<void()> task);
+
+    // Wait for all tasks in the group. Rethrows the first exception thrown by a task.
+    void wait();
+
+private:
+    ThreadPool &pool;
+    std::atomic<size_t> pending;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::exception_ptr exception;
+};
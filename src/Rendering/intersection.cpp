@@ -37,12 +37,16 @@ Intersection intersectWithSphere(const Ray &ray, const glm::vec3 &spherePos, dou
     glm::vec3 exit_point = ray.start + (float)exit_t * ray.direction;
     glm::vec3 exit_normal = glm::normalize(exit_point - spherePos);
 
+    // The texture covers the sphere once
+    float uvScale = 1.0 / (2.0 * std::sqrt(M_PI) * radius);
+
     intersection.isValid = true;
 
     intersection.entry.isValid = true;
     intersection.entry.position = entry_point;
     intersection.entry.normal = entry_normal;
     intersection.entry.tangent = glm::cross(glm::vec3(0, 1, 0), entry_point - spherePos);
+    intersection.entry.uvScale = uvScale;
     intersection.entry.node = nullptr;
     intersection.entry.uv = glm::vec2(1 - (atan2(entry_normal.x, entry_normal.z) / (2 * M_PI) + 0.5), entry_normal.y * 0.5 + 0.5);
 
@@ -50,6 +54,7 @@ Intersection intersectWithSphere(const Ray &ray, const glm::vec3 &spherePos, dou
     intersection.exit.position = exit_point;
     intersection.exit.normal = exit_normal;
     intersection.exit.tangent = glm::cross(glm::vec3(0, 1, 0), exit_point - spherePos);
+    intersection.exit.uvScale = uvScale;
     intersection.exit.node = nullptr;
     intersection.exit.uv = glm::vec2(1 - (atan2(exit_normal.x, exit_normal.z) / (2 * M_PI) + 0.5), exit_normal.y * 0.5 + 0.5);
 
@@ -81,23 +86,31 @@ Intersection intersectWithBox(const Ray &ray, const glm::vec3 &boxMin, const glm
     glm::vec3 entry_point = ray.start + (float)entry_t * ray.direction;
     glm::vec3 exit_point = ray.start + (float)exit_t * ray.direction;
 
+    // The texture covers each face once, so the UV scale depends on the size of the face
+    glm::vec3 size = boxMax - boxMin;
+    glm::vec3 faceUVScale = 1.0f / glm::sqrt(glm::vec3(size.y * size.z, size.x * size.z, size.x * size.y));
+
     glm::vec3 entry_normal;
     glm::vec3 entry_tangent;
     glm::vec2 entry_uv;
+    float entry_uvScale = 0.0f;
     if (entry_t == t1.x)
     {
+        entry_uvScale = faceUVScale.x;
         entry_normal = glm::vec3(-glm::sign(ray.direction.x), 0, 0);
         entry_uv = glm::vec2((entry_point.z - boxMin.z) / (boxMax.z - boxMin.z), 1.0 - (entry_point.y - boxMin.y) / (boxMax.y - boxMin.y));
         entry_tangent = glm::vec3(0, 0, 1);
     }
     else if (entry_t == t1.y)
     {
+        entry_uvScale = faceUVScale.y;
         entry_normal = glm::vec3(0, -glm::sign(ray.direction.y), 0);
         entry_uv = glm::vec2(1.0 - (entry_point.x - boxMin.x) / (boxMax.x - boxMin.x), 1.0 - (entry_point.z - boxMin.z) / (boxMax.z - boxMin.z));
         entry_tangent = glm::vec3(1, 0, 0);
     }
     else if (entry_t == t1.z)
     {
+        entry_uvScale = faceUVScale.z;
         entry_normal = glm::vec3(0, 0, -glm::sign(ray.direction.z));
         entry_uv = glm::vec2(1.0 - (entry_point.x - boxMin.x) / (boxMax.x - boxMin.x), 1.0 - (entry_point.y - boxMin.y) / (boxMax.y - boxMin.y));
         entry_tangent = glm::vec3(0, 1, 0);
@@ -106,20 +119,24 @@ Intersection intersectWithBox(const Ray &ray, const glm::vec3 &boxMin, const glm
     glm::vec3 exit_normal;
     glm::vec3 exit_tangent;
     glm::vec2 exit_uv;
+    float exit_uvScale = 0.0f;
     if (exit_t == t2.x)
     {
+        exit_uvScale = faceUVScale.x;
         exit_normal = glm::vec3(-glm::sign(ray.direction.x), 0, 0);
         exit_uv = glm::vec2((exit_point.z - boxMin.z) / (boxMax.z - boxMin.z), 1.0 - (exit_point.y - boxMin.y) / (boxMax.y - boxMin.y));
         exit_tangent = glm::vec3(0, 0, 1);
     }
     else if (exit_t == t2.y)
     {
+        exit_uvScale = faceUVScale.y;
         exit_normal = glm::vec3(0, -glm::sign(ray.direction.y), 0);
         exit_uv = glm::vec2(1.0 - (exit_point.x - boxMin.x) / (boxMax.x - boxMin.x), 1.0 - (exit_point.z - boxMin.z) / (boxMax.z - boxMin.z));
         exit_tangent = glm::vec3(1, 0, 0);
     }
     else if (exit_t == t2.z)
     {
+        exit_uvScale = faceUVScale.z;
         exit_normal = glm::vec3(0, 0, -glm::sign(ray.direction.z));
         exit_uv = glm::vec2(1.0 - (exit_point.x - boxMin.x) / (boxMax.x - boxMin.x), 1.0 - (exit_point.y - boxMin.y) / (boxMax.y - boxMin.y));
         exit_tangent = glm::vec3(0, 1, 0);
@@ -133,6 +150,7 @@ Intersection intersectWithBox(const Ray &ray, const glm::vec3 &boxMin, const glm
     intersection.entry.tangent = entry_tangent;
     intersection.entry.node = nullptr;
     intersection.entry.uv = entry_uv;
+    intersection.entry.uvScale = entry_uvScale;
 
     intersection.exit.isValid = true;
     intersection.exit.position = exit_point;
@@ -140,10 +158,78 @@ Intersection intersectWithBox(const Ray &ray, const glm::vec3 &boxMin, const glm
     intersection.exit.tangent = exit_tangent;
     intersection.exit.node = nullptr;
     intersection.exit.uv = exit_uv;
+    intersection.exit.uvScale = exit_uvScale;
+
+    return intersection;
+}
+
+// Both sides of a flat surface at a point. The ray enters and leaves the surface at the same point, and
+// the normal faces the ray like it does for the faces of a box.
+static Intersection intersectionWithPlanarPoint(const Ray &ray, const glm::vec3 &point, const glm::vec2 &uv, float uvScale)
+{
+    Intersection intersection;
+    intersection.isValid = true;
+
+    intersection.entry.isValid = true;
+    intersection.entry.position = point;
+    intersection.entry.normal = glm::vec3(0, -glm::sign(ray.direction.y), 0);
+    intersection.entry.tangent = glm::vec3(1, 0, 0);
+    intersection.entry.node = nullptr;
+    intersection.entry.uv = uv;
+    intersection.entry.uvScale = uvScale;
+
+    intersection.exit = intersection.entry;
 
     return intersection;
 }
 
+Intersection intersectWithQuad(const Ray &ray, const glm::vec3 &quadMin, const glm::vec2 &size)
+{
+    // The quad lies in the XZ plane at quadMin.y, so a ray parallel to it can never hit it
+    if (ray.direction.y == 0)
+    {
+        return Intersection();
+    }
+
+    float t = (quadMin.y - ray.start.y) / ray.direction.y;
+    glm::vec3 point = ray.start + t * ray.direction;
+    glm::vec2 offset = glm::vec2(point.x - quadMin.x, point.z - quadMin.z) / size;
+    if (offset.x < 0 || offset.x > 1 || offset.y < 0 || offset.y > 1)
+    {
+        return Intersection();
+    }
+
+    // The same UVs as the top and bottom faces of a box
+    return intersectionWithPlanarPoint(ray, point, glm::vec2(1.0 - offset.x, 1.0 - offset.y), 1.0f / std::sqrt(size.x * size.y));
+}
+
+Intersection intersectWithDisk(const Ray &ray, const glm::vec3 &center, double radius)
+{
+    // The disk lies in the XZ plane at center.y, so a ray parallel to it can never hit it
+    if (ray.direction.y == 0)
+    {
+        return Intersection();
+    }
+
+    float t = (center.y - ray.start.y) / ray.direction.y;
+    glm::vec3 point = ray.start + t * ray.direction;
+    glm::vec2 offset = glm::vec2(point.x - center.x, point.z - center.z) / (float)radius;
+    if (glm::dot(offset, offset) > 1)
+    {
+        return Intersection();
+    }
+
+    // The UVs of the square around the disk, like those of a quad
+    return intersectionWithPlanarPoint(ray, point, glm::vec2(0.5 - 0.5 * offset.x, 0.5 - 0.5 * offset.y), 0.5 / radius);
+}
+
+// The texture coordinates of a point on a cylinder, relative to the center of its base. The texture wraps
+// around the cylinder once, and repeats along it every unit of the unscaled cylinder.
+static glm::vec2 cylinderUV(const glm::vec3 &offset, double height)
+{
+    return glm::vec2(atan2(offset.x, offset.z) / (2 * M_PI) + 0.5, 1 - glm::mod(offset.y / (float)height, 1.0f));
+}
+
 Intersection intersectWithCylinder(const Ray &ray, const glm::vec3 &center, double radius, double height)
 {
     Intersection intersection;
@@ -218,6 +304,9 @@ Intersection intersectWithCylinder(const Ray &ray, const glm::vec3 &center, doub
         exit_normal = glm::vec3(0, 1, 0);
     }
 
+    // The texture wraps around the side once (the caps use the same scale)
+    float uvScale = 1.0 / std::sqrt(2.0 * M_PI * radius * height);
+
     intersection.isValid = true;
 
     intersection.entry.isValid = true;
@@ -225,14 +314,16 @@ Intersection intersectWithCylinder(const Ray &ray, const glm::vec3 &center, doub
     intersection.entry.normal = entry_normal;
     intersection.entry.tangent = entry_normal.x == 0 && entry_normal.z == 0 ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
     intersection.entry.node = nullptr;
-    intersection.entry.uv = glm::vec2(atan2(entry_point.x, entry_point.z) / (2 * M_PI) + 0.5, 1 - glm::mod(entry_point.y, 1.0f));
+    intersection.entry.uv = cylinderUV(entry_point - center, height);
+    intersection.entry.uvScale = uvScale;
 
     intersection.exit.isValid = true;
     intersection.exit.position = exit_point;
     intersection.exit.normal = exit_normal;
     intersection.exit.tangent = exit_normal.x == 0 && exit_normal.z == 0 ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
     intersection.exit.node = nullptr;
-    intersection.exit.uv = glm::vec2(atan2(exit_point.x, exit_point.z) / (2 * M_PI) + 0.5, 1 - glm::mod(exit_point.y, 1.0f));
+    intersection.exit.uv = cylinderUV(exit_point - center, height);
+    intersection.exit.uvScale = uvScale;
 
     return intersection;
 }
@@ -338,6 +429,9 @@ Intersection intersectWithCone(const Ray &ray, const glm::vec3 &center)
         std::swap(first_normal, second_normal);
     }
 
+    // The texture wraps around the side once (the cap uses the same scale)
+    float uvScale = 1.0 / std::sqrt(M_PI * std::sqrt(2.0) * height * height);
+
     intersection.isValid = true;
 
     intersection.entry.isValid = true;
@@ -347,6 +441,7 @@ Intersection intersectWithCone(const Ray &ray, const glm::vec3 &center)
     intersection.entry.tangent = glm::vec3(glm::cos(angle), 1, glm::sin(angle));
     intersection.entry.node = nullptr;
     intersection.entry.uv = glm::vec2(angle / (2 * M_PI) + 0.5, 1 - glm::mod(first_point.y, 1.0f));
+    intersection.entry.uvScale = uvScale;
 
     intersection.exit.isValid = true;
     intersection.exit.position = second_point;
@@ -355,6 +450,7 @@ Intersection intersectWithCone(const Ray &ray, const glm::vec3 &center)
     intersection.exit.tangent = glm::vec3(glm::cos(angle), 1, glm::sin(angle));
     intersection.exit.node = nullptr;
     intersection.exit.uv = glm::vec2(angle / (2 * M_PI) + 0.5, 1 - glm::mod(second_point.y, 1.0f));
+    intersection.exit.uvScale = uvScale;
 
     return intersection;
 }
@@ -433,7 +529,8 @@ SurfacePoint intersectWithTriangle(const Ray &ray, const glm::vec3 &v0, const gl
     glm::vec2 deltaUV1 = t1 - t0;
     glm::vec2 deltaUV2 = t2 - t0;
 
-    float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
+    float uvArea = deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y;
+    float f = 1.0f / uvArea;
 
     glm::vec3 tangent;
     tangent.x = f * (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x);
@@ -446,6 +543,7 @@ SurfacePoint intersectWithTriangle(const Ray &ray, const glm::vec3 &v0, const gl
     surfacePoint.tangent = glm::normalize(tangent);
     surfacePoint.node = nullptr;
     surfacePoint.uv = uv;
+    surfacePoint.uvScale = std::sqrt(std::abs(uvArea) / area);
 
     return surfacePoint;
 }
\ No newline at end of file
@@ -2,22 +2,28 @@
 
 #include <memory>
 #include <iostream>
+#include <limits>
 #include <glm/glm.hpp>
 
 class GeometryNode;
+class Material;
 
+// A ray, with the cone around it that covers the area the ray stands for (e.g. one pixel). The cone
+// is an isotropic ray differential: it is used to choose how much to filter textures where the ray hits.
 struct Ray
 {
-    Ray(const glm::vec3 &start, const glm::vec3 &direction)
-        : start(start), direction(direction)
+    Ray(const glm::vec3 &start, const glm::vec3 &direction, float coneWidth = 0.0f, float coneSpread = 0.0f)
+        : start(start), direction(direction), coneWidth(coneWidth), coneSpread(coneSpread)
     {
     }
 
     Ray(const Ray &ray)
-        : start(ray.start), direction(ray.direction)
+        : start(ray.start), direction(ray.direction), coneWidth(ray.coneWidth), coneSpread(ray.coneSpread)
     {
     }
 
+    Ray &operator=(const Ray &ray) = default;
+
     float getT(const glm::vec3 &point) const
     {
         glm::vec3 diff = point - start;
@@ -27,8 +33,17 @@ struct Ray
         return t;
     }
 
+    // The width of the cone at a distance t along the ray
+    float getConeWidth(float t) const
+    {
+        return coneWidth + coneSpread * t;
+    }
+
     glm::vec3 start;
     glm::vec3 direction;
+    // The width of the cone at the start of the ray, and how much wider it gets per unit of distance
+    float coneWidth;
+    float coneSpread;
 };
 
 struct SurfacePoint
@@ -38,22 +53,30 @@ struct SurfacePoint
     glm::vec3 normal;
     glm::vec3 tangent;
     glm::vec2 uv;
+    // How much the texture coordinates change per unit of distance along the surface (the square root of
+    // the area in texture space over the area on the surface), or 0 if it is not known
+    float uvScale;
     const GeometryNode *node;
+    // The material to shade with. This is the material of the node, unless an instance overrides it.
+    const Material *material;
+    // The top-level object of the scene that was hit, or -1 if it is not known. Unlike the node, this
+    // tells apart the instances of a prototype.
+    int objectId;
 
     SurfacePoint()
-        : isValid(false)
+        : isValid(false), uvScale(0.0f), node(nullptr), material(nullptr), objectId(-1)
     {
     }
 
     // Copy constructor
     SurfacePoint(const SurfacePoint &surfacePoint)
-        : isValid(surfacePoint.isValid), position(surfacePoint.position), normal(surfacePoint.normal), tangent(surfacePoint.tangent), uv(surfacePoint.uv), node(surfacePoint.node)
+        : isValid(surfacePoint.isValid), position(surfacePoint.position), normal(surfacePoint.normal), tangent(surfacePoint.tangent), uv(surfacePoint.uv), uvScale(surfacePoint.uvScale), node(surfacePoint.node), material(surfacePoint.material), objectId(surfacePoint.objectId)
     {
     }
 
     // Move constructor
     SurfacePoint(SurfacePoint &&surfacePoint)
-        : isValid(surfacePoint.isValid), position(std::move(surfacePoint.position)), normal(std::move(surfacePoint.normal)), tangent(std::move(surfacePoint.tangent)), uv(std::move(surfacePoint.uv)), node(surfacePoint.node)
+        : isValid(surfacePoint.isValid), position(std::move(surfacePoint.position)), normal(std::move(surfacePoint.normal)), tangent(std::move(surfacePoint.tangent)), uv(std::move(surfacePoint.uv)), uvScale(surfacePoint.uvScale), node(surfacePoint.node), material(surfacePoint.material), objectId(surfacePoint.objectId)
     {
     }
 
@@ -64,7 +87,10 @@ struct SurfacePoint
         normal = surfacePoint.normal;
         tangent = surfacePoint.tangent;
         uv = surfacePoint.uv;
+        uvScale = surfacePoint.uvScale;
         node = surfacePoint.node;
+        material = surfacePoint.material;
+        objectId = surfacePoint.objectId;
         return *this;
     }
 
@@ -75,7 +101,10 @@ struct SurfacePoint
         normal = std::move(surfacePoint.normal);
         tangent = std::move(surfacePoint.tangent);
         uv = std::move(surfacePoint.uv);
+        uvScale = surfacePoint.uvScale;
         node = surfacePoint.node;
+        material = surfacePoint.material;
+        objectId = surfacePoint.objectId;
         return *this;
     }
 };
@@ -120,8 +149,91 @@ struct Intersection
     }
 };
 
+// An axis aligned bounding box. A default constructed box is empty.
+struct AABB
+{
+    glm::vec3 min;
+    glm::vec3 max;
+
+    AABB()
+        : min(std::numeric_limits<float>::infinity()), max(-std::numeric_limits<float>::infinity())
+    {
+    }
+
+    AABB(const glm::vec3 &min, const glm::vec3 &max)
+        : min(min), max(max)
+    {
+    }
+
+    bool isEmpty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void extend(const glm::vec3 &point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void extend(const AABB &box)
+    {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+
+    glm::vec3 center() const
+    {
+        return 0.5f * (min + max);
+    }
+
+    float surfaceArea() const
+    {
+        if (isEmpty())
+        {
+            return 0.0f;
+        }
+
+        glm::vec3 size = max - min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    // The bounds of the box after an affine transformation
+    AABB transformed(const glm::mat4 &transform) const
+    {
+        AABB result;
+        if (isEmpty())
+        {
+            return result;
+        }
+
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            glm::vec3 point((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z);
+            result.extend(glm::vec3(transform * glm::vec4(point, 1.0f)));
+        }
+        return result;
+    }
+
+    // Check if the ray passes through the box between t = 0 and tMax, and if so where it enters the box.
+    // The inverse of the ray direction is passed in, so that it is only computed once per ray.
+    bool intersect(const glm::vec3 &start, const glm::vec3 &inverseDirection, float tMax, float &tEntry) const
+    {
+        glm::vec3 t0 = (min - start) * inverseDirection;
+        glm::vec3 t1 = (max - start) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+
+        tEntry = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+        float tExit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, tMax));
+        return tEntry <= tExit;
+    }
+};
+
 Intersection intersectWithSphere(const Ray &ray, const glm::vec3 &spherePos, double radius);
 Intersection intersectWithBox(const Ray &ray, const glm::vec3 &boxMin, const glm::vec3 &boxMax);
+Intersection intersectWithQuad(const Ray &ray, const glm::vec3 &quadMin, const glm::vec2 &size);
+Intersection intersectWithDisk(const Ray &ray, const glm::vec3 &center, double radius);
 Intersection intersectWithCylinder(const Ray &ray, const glm::vec3 &center, double radius, double height);
 Intersection intersectWithCone(const Ray &ray, const glm::vec3 &center);
 SurfacePoint intersectWithTriangle(const Ray &ray, const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const glm::vec2 &t0, const glm::vec2 &t1, const glm::vec2 &t2, const glm::vec3 &n0, const glm::vec3 &n1, const glm::vec3 &n2);
\ No newline at end of file
@@ -52,7 +52,6 @@ render_metadata = {
     scene_ambient = {0.3, 0.3, 0.3},
     scene_lights = {white_light, magenta_light},
     enable_supersampling = false,
-    thread_count = 8,
     background_image = "./Assets/background_bliss.png"
 }
 
@@ -90,7 +90,6 @@ render_metadata = {
     scene_ambient = {0.5, 0.5, 0.5},
     scene_lights = {white_light, white_light_2},
     enable_supersampling = false,
-    thread_count = 8,
     background_image = ""
 }
 
@@ -67,7 +67,6 @@ render_metadata = {
     scene_ambient = {0.0, 0.0, 0.0},
     scene_lights = {gr.light({0, 10, -5}, {0.1, 0.1, 0.1}, {1, 0, 0})},
     enable_supersampling = false,
-    thread_count = 8,
     background_image = ""
 }
 
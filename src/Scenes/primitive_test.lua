@@ -31,7 +31,6 @@ render_metadata = {
     scene_ambient = {0.5, 0.5, 0.5},
     scene_lights = {white_light},
     enable_supersampling = false,
-    thread_count = 8,
     background_image = ""
 }
 
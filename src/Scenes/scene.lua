@@ -389,7 +389,6 @@ render_metadata = {
     scene_ambient = {0.2, 0.2, 0.2},
     scene_lights = lights,
     enable_supersampling = true,
-    thread_count = 8,
     background_image = "./Assets/background_scene.png"
 }
 
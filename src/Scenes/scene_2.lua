@@ -169,7 +169,6 @@ render_metadata = {
     scene_ambient = {0.1, 0.1, 0.1},
     scene_lights = lights,
     enable_supersampling = false,
-    thread_count = 8,
     background_image = ""
 }
 
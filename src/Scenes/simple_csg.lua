@@ -89,7 +89,6 @@ render_metadata = {
     scene_ambient = {0.5, 0.5, 0.5},
     scene_lights = {white_light},
     enable_supersampling = false,
-    thread_count = 8,
     background_image = ""
 }
 
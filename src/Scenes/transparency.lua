@@ -183,7 +183,6 @@ render_metadata = {
     scene_ambient = {0.4, 0.4, 0.6},
     scene_lights = lights,
     enable_supersampling = false,
-    thread_count = 8,
     background_image = ""
 }
 
@@ -0,0 +1,70 @@
+-- The gr.animate turntable example: the camera orbits the scene over 36 frames, which are
+-- written to numbered images and rendered concurrently since only the camera moves.
+
+mat1 = gr.material({0.7, 1.0, 0.7}, {0.5, 0.7, 0.5}, 25, 0.5, 0.0)
+mat2 = gr.material({0.5, 0.5, 0.5}, {0.5, 0.7, 0.5}, 25, 0.5, 0.0)
+mat3 = gr.material({1.0, 0.6, 0.1}, {0.5, 0.7, 0.5}, 25, 0.5, 0.0)
+mat4 = gr.material({0.7, 0.6, 1.0}, {0.5, 0.4, 0.8}, 25, 0.5, 0.0)
+
+scene_root = gr.node('root')
+
+s1 = gr.nh_sphere('s1', {0, 0, -400}, 100)
+scene_root:add_child(s1)
+s1:set_material(mat1)
+
+s2 = gr.nh_sphere('s2', {200, 50, -100}, 150)
+scene_root:add_child(s2)
+s2:set_material(mat1)
+
+s3 = gr.nh_sphere('s3', {0, -1200, -500}, 1000)
+scene_root:add_child(s3)
+s3:set_material(mat2)
+
+b1 = gr.nh_box('b1', {-200, -225, 100}, 100)
+scene_root:add_child(b1)
+b1:set_material(mat4)
+
+-- s4 = gr.nh_sphere('s4', {-100, 25, -300}, 50)
+s4 = gr.nh_sphere('s4', {-150, -085, 150}, 30)
+scene_root:add_child(s4)
+s4:set_material(mat3)
+
+s5 = gr.nh_sphere('s5', {0, 100, -250}, 25)
+scene_root:add_child(s5)
+s5:set_material(mat1)
+
+-- A small stellated dodecahedron.
+
+steldodec = gr.mesh( 'dodec', './Assets/smstdodeca.obj' )
+steldodec:set_material(mat3)
+scene_root:add_child(steldodec)
+
+white_light = gr.light({-100.0, 150.0, 400.0}, {0.9, 0.9, 0.9}, {1, 0, 0})
+magenta_light = gr.light({400.0, 100.0, 150.0}, {0.7, 0.0, 0.7}, {1, 0, 0})
+
+render_metadata = {
+    image_name = './Images/turntable_%03d.png',
+    image_width = 512,
+    image_height = 512,
+    camera_eye = {0, 0, 800},
+    camera_view = {0, 0, -1},
+    camera_up = {0, 1, 0},
+    camera_fovy = 50,
+    scene_ambient = {0.3, 0.3, 0.3},
+    scene_lights = {white_light, magenta_light},
+    enable_supersampling = false,
+    background_image = ""
+}
+
+-- Orbit the camera around the scene. Only the camera moves, so the frames are rendered concurrently.
+gr.animate(scene_root, render_metadata, {
+    frame_start = 0,
+    frame_end = 35,
+    camera = function(frame)
+        local angle = math.rad(frame * 10)
+        return {
+            camera_eye = {800 * math.sin(angle), 0, 800 * math.cos(angle)},
+            camera_view = {-math.sin(angle), 0, -math.cos(angle)}
+        }
+    end
+})